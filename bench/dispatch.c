@@ -0,0 +1,90 @@
+/* dispatch microbenchmark: workers claim tiny jobs from a shared queue,
+ * with the old mutex dispatcher and with the lock-free batched one */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "hashsumr.h"
+#include "dispatch.h"
+
+#define	NJOBS	2000000
+
+static int njobs = NJOBS;
+static int nextjob = 0;
+static pthread_mutex_t mutex_jobs = PTHREAD_MUTEX_INITIALIZER;
+static dispatch_t dispatcher;
+static volatile unsigned long long sink = 0;
+static int work = 200;	/* ~ per-job cost of a tiny file, in loop iterations */
+
+static unsigned long long
+dowork(int idx) {
+	unsigned long long x = idx;
+	int i;
+	for(i = 0; i < work; i++) x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+	return x;
+}
+
+static void *
+worker_mutex(void *__) {
+	unsigned long long x = 0;
+	int idx;
+	while(1) {
+		pthread_mutex_lock(&mutex_jobs);
+		idx = nextjob < njobs ? nextjob++ : -1;
+		pthread_mutex_unlock(&mutex_jobs);
+		if(idx < 0) break;
+		x += dowork(idx);
+	}
+	ATOMIC_ADD64(&sink, x);
+	return NULL;
+}
+
+static void *
+worker_batch(void *__) {
+	unsigned long long x = 0;
+	batch_t batch;
+	int idx;
+	dispatch_batch_init(&batch);
+	while((idx = dispatch_next(&dispatcher, &batch)) >= 0) {
+		x += dowork(idx);
+		dispatch_feedback(&batch, 4096);
+	}
+	ATOMIC_ADD64(&sink, x);
+	return NULL;
+}
+
+static double
+now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double
+run(int nthreads, void *(*fn)(void *)) {
+	pthread_t tids[256];
+	double t0;
+	int i;
+	nextjob = 0;
+	dispatch_init(&dispatcher, njobs, nthreads);
+	t0 = now();
+	for(i = 0; i < nthreads; i++) pthread_create(&tids[i], NULL, fn, NULL);
+	for(i = 0; i < nthreads; i++) pthread_join(tids[i], NULL);
+	return now() - t0;
+}
+
+int
+main(int argc, char *argv[]) {
+	int threads[] = { 1, 2, 4, 8, 16, 32, 64 };
+	int i;
+	if(argc > 1) work = atoi(argv[1]);
+	printf("# jobs = %d, work/job = %d\n", njobs, work);
+	printf("%-8s %14s %14s %8s\n", "threads", "mutex jobs/s", "batch jobs/s", "speedup");
+	for(i = 0; i < (int) (sizeof(threads)/sizeof(int)); i++) {
+		double tm = run(threads[i], worker_mutex);
+		double tb = run(threads[i], worker_batch);
+		printf("%-8d %14.0f %14.0f %7.2fx\n", threads[i], njobs / tm, njobs / tb, tm / tb);
+	}
+	return 0;
+}
@@ -0,0 +1,127 @@
+/* hex microbenchmark: per-line digest work of a check run, the old
+ * snprintf/isxdigit/strcasecmp path against decode once + memcmp,
+ * and hex output of hash mode */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <strings.h>
+#include "hex.h"
+
+#define	NLINES	(1<<20)
+#define	MAXLEN	64
+
+static unsigned char (*bins)[MAXLEN];
+static char (*hexes)[2*MAXLEN+2];
+static volatile unsigned long long sink = 0;
+
+static int
+old_is_hex(const char *s) {
+	for(; *s; s++) {
+		if(isxdigit(*s) == 0) return 0;
+	}
+	return 1;
+}
+
+static void
+old_encode(const unsigned char *hash, unsigned int hlen, char *digest, unsigned int dlen) {
+	unsigned int i;
+	int sz, clen = 0;
+	for(i = 0; i < hlen; i++) {
+		sz = snprintf(digest + clen, dlen - clen, "%02x", hash[i]);
+		clen += sz;
+	}
+}
+
+static double
+now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double	/* load: validate the manifest digest; print: format, compare as text */
+check_old(int len) {
+	char hex[2*MAXLEN+2];
+	unsigned long long ok = 0;
+	double t0 = now();
+	int i;
+	for(i = 0; i < NLINES; i++) {
+		ok += old_is_hex(hexes[i]);
+		old_encode(bins[i], len, hex, sizeof(hex));
+		ok += strcasecmp(hexes[i], hex) == 0;
+	}
+	sink += ok;
+	return now() - t0;
+}
+
+static double	/* load: decode the manifest digest; print: compare bytes */
+check_new(int len) {
+	unsigned char bin[MAXLEN];
+	unsigned long long ok = 0;
+	double t0 = now();
+	int i;
+	for(i = 0; i < NLINES; i++) {
+		ok += hex_decode(hexes[i], bin, sizeof(bin)) == len;
+		ok += memcmp(bin, bins[i], len) == 0;
+	}
+	sink += ok;
+	return now() - t0;
+}
+
+static double
+encode_old(int len) {
+	char hex[2*MAXLEN+2];
+	double t0 = now();
+	int i;
+	for(i = 0; i < NLINES; i++) {
+		old_encode(bins[i], len, hex, sizeof(hex));
+		sink += hex[0];
+	}
+	return now() - t0;
+}
+
+static double
+encode_new(int len) {
+	char hex[2*MAXLEN+2];
+	double t0 = now();
+	int i;
+	for(i = 0; i < NLINES; i++) {
+		hex_encode(bins[i], len, hex, sizeof(hex));
+		sink += hex[0];
+	}
+	return now() - t0;
+}
+
+int
+main(int argc, char *argv[]) {
+	int lens[] = { 16, 32, 64 };	/* MD5, SHA256, SHA512 */
+	int i, j, k;
+	bins = malloc(sizeof(*bins) * NLINES);
+	hexes = malloc(sizeof(*hexes) * NLINES);
+	if(bins == NULL || hexes == NULL)
+		return 1;
+	srand(1);
+	printf("# lines = %d, ns per line\n", NLINES);
+	printf("%-6s %10s %10s %8s %10s %10s %8s\n", "bytes",
+		"check old", "check new", "speedup", "hex old", "hex new", "speedup");
+	for(i = 0; i < (int) (sizeof(lens)/sizeof(int)); i++) {
+		double co, cn, eo, en;
+		for(j = 0; j < NLINES; j++) {
+			for(k = 0; k < lens[i]; k++) bins[j][k] = rand() & 0xff;
+			old_encode(bins[j], lens[i], hexes[j], sizeof(hexes[j]));
+			if(j & 1) {	/* manifests may use either case */
+				for(k = 0; hexes[j][k]; k++) hexes[j][k] = toupper(hexes[j][k]);
+			}
+		}
+		co = check_old(lens[i]);
+		cn = check_new(lens[i]);
+		eo = encode_old(lens[i]);
+		en = encode_new(lens[i]);
+		printf("%-6d %10.1f %10.1f %7.1fx %10.1f %10.1f %7.1fx\n", lens[i],
+			co * 1e9 / NLINES, cn * 1e9 / NLINES, co / cn,
+			eo * 1e9 / NLINES, en * 1e9 / NLINES, eo / en);
+	}
+	return 0;
+}
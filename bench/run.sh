@@ -0,0 +1,175 @@
+#!/usr/bin/env bash
+# end-to-end benchmark: builds synthetic corpora in a temp dir and times
+# hashsumr over them across algorithms, worker counts, and cold/warm
+# page cache. one tab-separated line per run on stdout, progress on stderr.
+#
+# usage: bench/run.sh [path/to/hashsumr]
+#
+# environment (defaults in brackets):
+#   BENCH_DIR      corpora directory, reused if it exists [mktemp -d, removed]
+#   BENCH_ALGS     algorithms [SHA256 SHA512 MD5 BLAKE3]
+#   BENCH_WORKERS  worker counts, 0 = one per processor [1 0]
+#   BENCH_CORPORA  corpora to run [tiny mixed huge sparse]
+#   BENCH_TINY     # of tiny files [1000000]
+#   BENCH_MIXED    # of mixed size files, 1 byte to 64MiB [2000]
+#   BENCH_HUGE     # of huge files [3]
+#   BENCH_HUGE_MB  size of a huge file in MiB [1024]
+#   BENCH_SPARSE_MB size of a sparse file in MiB [4096]
+#   BENCH_CACHE    page cache states [cold warm]; cold needs root on linux
+#                  (drop_caches) or purge(8) on macOS, skipped otherwise
+#   BENCH_REPEAT   runs per configuration, the fastest is kept [1]
+
+set -u
+export LC_ALL=C
+
+BIN=${1:-./hashsumr}
+ALGS=${BENCH_ALGS:-"SHA256 SHA512 MD5 BLAKE3"}
+WORKERS=${BENCH_WORKERS:-"1 0"}
+CORPORA=${BENCH_CORPORA:-"tiny mixed huge sparse"}
+NTINY=${BENCH_TINY:-1000000}
+NMIXED=${BENCH_MIXED:-2000}
+NHUGE=${BENCH_HUGE:-3}
+HUGE_MB=${BENCH_HUGE_MB:-1024}
+SPARSE_MB=${BENCH_SPARSE_MB:-4096}
+CACHES=${BENCH_CACHE:-"cold warm"}
+REPEAT=${BENCH_REPEAT:-1}
+
+if [ ! -x "$BIN" ]; then
+	echo "bench: $BIN is not an executable" >&2
+	exit 1
+fi
+BIN=$(cd "$(dirname "$BIN")" && pwd)/$(basename "$BIN")
+
+if [ -n "${BENCH_DIR:-}" ]; then
+	DIR=$BENCH_DIR
+	mkdir -p "$DIR" || exit 1
+else
+	DIR=$(mktemp -d "${TMPDIR:-/tmp}/hashsumr-bench.XXXXXX") || exit 1
+	trap 'rm -rf "$DIR"' EXIT
+	trap 'exit 130' INT TERM
+fi
+
+log() {
+	echo "bench: $*" >&2
+}
+
+# corpora, each one is built once and marked complete with a .done file
+
+make_tiny() {	# NTINY files of 1 to 64 bytes, 1000 per directory
+	log "creating $NTINY tiny files"
+	awk -v n="$NTINY" -v d="$1" 'BEGIN {
+		srand(1);
+		for(i = 0; i < n; i++) {
+			if(i % 1000 == 0) {
+				sub_ = sprintf("%s/%04d", d, i / 1000);
+				system("mkdir -p " sub_);
+			}
+			f = sprintf("%s/%d", sub_, i);
+			printf("%s\n", substr("0123456789abcdefghijklmnopqrstuvwxyz0123456789abcdefghijklmnopqrstuvwxyz", 1, 1 + int(rand() * 63))) > f;
+			close(f);
+		}
+	}'
+}
+
+make_mixed() {	# NMIXED files, log-uniform sizes from 1 byte to 64MiB
+	log "creating $NMIXED mixed size files"
+	dd if=/dev/urandom of="$1/.seed" bs=1048576 count=64 2>/dev/null || return 1
+	awk -v n="$NMIXED" 'BEGIN { srand(2); for(i = 0; i < n; i++) printf("%d %d\n", i, int(exp(rand() * log(64 * 1048576)))); }' |
+	while read -r i sz; do
+		head -c "$sz" "$1/.seed" > "$1/m$i" || return 1
+	done
+	rm -f "$1/.seed"
+}
+
+make_huge() {	# NHUGE files of HUGE_MB MiB of random data
+	local i
+	for i in $(seq 1 "$NHUGE"); do
+		log "creating huge file $i/$NHUGE ($HUGE_MB MiB)"
+		dd if=/dev/urandom of="$1/h$i" bs=1048576 count="$HUGE_MB" 2>/dev/null || return 1
+	done
+}
+
+make_sparse() {	# holes around a few MiB of data
+	log "creating sparse file ($SPARSE_MB MiB)"
+	dd if=/dev/urandom of="$1/s1" bs=1048576 count=4 seek=$((SPARSE_MB / 2)) 2>/dev/null || return 1
+	dd if=/dev/zero of="$1/s1" bs=1048576 count=0 seek="$SPARSE_MB" 2>/dev/null
+}
+
+corpus() {
+	local c=$DIR/$1
+	if [ ! -f "$c.done" ]; then
+		rm -rf "$c"
+		mkdir -p "$c" || return 1
+		"make_$1" "$c" || { log "cannot create the $1 corpus"; return 1; }
+		# files and bytes, hashsumr reads holes as zeros
+		find "$c" -type f -exec ls -ln {} + | awk '{ n++; b += $5 } END { printf("%d %.0f\n", n, b) }' > "$c.done"
+	fi
+	return 0
+}
+
+drop_caches() {	# 0 if the page cache was emptied
+	sync
+	case $(uname -s) in
+	Linux)
+		[ -w /proc/sys/vm/drop_caches ] && echo 3 > /proc/sys/vm/drop_caches ;;
+	Darwin)
+		purge 2>/dev/null ;;
+	*)
+		return 1 ;;
+	esac
+}
+
+ncpu() {
+	getconf _NPROCESSORS_ONLN 2>/dev/null || sysctl -n hw.ncpu 2>/dev/null || echo 1
+}
+
+# run once, prints "real user sys status"
+run1() {
+	local t status
+	TIMEFORMAT='%3R %3U %3S'
+	t=$( { time "$BIN" "$@" > /dev/null 2>&1; echo "status $?" >&2; } 2>&1 )
+	status=$(echo "$t" | awk '$1 == "status" { print $2 }')
+	echo "$(echo "$t" | awk '$1 != "status"') $status"
+}
+
+# resolve 0 and drop repeated counts, e.g., "1 0" on a single processor
+nws=
+for w in $WORKERS; do
+	[ "$w" = 0 ] && w=$(ncpu)
+	case " $nws " in *" $w "*) ;; *) nws="$nws $w" ;; esac
+done
+
+printf "corpus\talg\tworkers\tcache\tfiles\tbytes\treal_s\tuser_s\tsys_s\tfiles_per_s\tgb_per_s\tcpu_pct\tstatus\n"
+log "$("$BIN" --version 2>&1 | head -1), $(ncpu) processor(s), corpora in $DIR"
+
+for c in $CORPORA; do
+	corpus "$c" || continue
+	read -r files bytes < "$DIR/$c.done"
+	for cache in $CACHES; do
+		if [ "$cache" = cold ] && ! drop_caches; then
+			log "cannot drop the page cache, cold runs skipped"
+			continue
+		fi
+		for alg in $ALGS; do
+			for nw in $nws; do
+				best=
+				for r in $(seq 1 "$REPEAT"); do
+					if [ "$cache" = cold ]; then
+						drop_caches
+					else	# warm up
+						"$BIN" -a "$alg" --workers "$nw" -r "$DIR/$c" > /dev/null 2>&1
+					fi
+					res=$(run1 -a "$alg" --workers "$nw" -r "$DIR/$c")
+					if [ -z "$best" ] || awk -v a="$res" -v b="$best" 'BEGIN { split(a, x, " "); split(b, y, " "); exit !(x[1] < y[1]) }'; then
+						best=$res
+					fi
+				done
+				echo "$best" | awk -v c="$c" -v a="$alg" -v w="$nw" -v k="$cache" -v f="$files" -v b="$bytes" '{
+					real = $1 > 0 ? $1 : 0.001;
+					printf("%s\t%s\t%d\t%s\t%d\t%.0f\t%.3f\t%.3f\t%.3f\t%.0f\t%.3f\t%.0f\t%d\n",
+						c, a, w, k, f, b, $1, $2, $3, f / real, b / real / 1e9, ($2 + $3) / real * 100, $4);
+				}'
+			done
+		done
+	done
+done
@@ -0,0 +1,76 @@
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <malloc.h>
+#else
+#include <sys/mman.h>
+#endif
+#include "hashsumr.h"
+#include "bufpool.h"
+
+static THREAD_LOCAL buf_t readbuf;
+
+int	/* allocate an aligned buffer, try huge pages first if asked to */
+bufpool_alloc(buf_t *buf, size_t size, int huge) {
+	size_t len = (size + BUFPOOL_ALIGN - 1) & ~((size_t) BUFPOOL_ALIGN - 1);
+	memset(buf, 0, sizeof(buf_t));
+#ifdef _WIN32
+	if((buf->ptr = (char *) _aligned_malloc(len, BUFPOOL_ALIGN)) == NULL)
+		return -1;
+#else
+	if(huge) {
+		len = (len + BUFPOOL_HUGE_SIZE - 1) & ~((size_t) BUFPOOL_HUGE_SIZE - 1);
+#ifdef MAP_HUGETLB
+		buf->ptr = (char *) mmap(NULL, len, PROT_READ|PROT_WRITE,
+			MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB, -1, 0);
+		if(buf->ptr != MAP_FAILED) {
+			buf->size = size;
+			buf->maplen = len;
+			buf->mapped = 1;
+			return 0;
+		}
+		buf->ptr = NULL;
+#endif
+	}
+	if(posix_memalign((void **) &buf->ptr, huge ? BUFPOOL_HUGE_SIZE : BUFPOOL_ALIGN, len) != 0) {
+		buf->ptr = NULL;
+		return -1;
+	}
+#ifdef MADV_HUGEPAGE
+	/* no reserved huge pages, transparent huge pages may still work */
+	if(huge) madvise(buf->ptr, len, MADV_HUGEPAGE);
+#endif
+#endif
+	buf->size = size;
+	buf->maplen = len;
+	return 0;
+}
+
+void
+bufpool_free(buf_t *buf) {
+	if(buf->ptr == NULL) return;
+#ifdef _WIN32
+	_aligned_free(buf->ptr);
+#else
+	if(buf->mapped) {
+		munmap(buf->ptr, buf->maplen);
+	} else {
+		free(buf->ptr);
+	}
+#endif
+	memset(buf, 0, sizeof(buf_t));
+}
+
+buf_t *	/* the read buffer of the calling thread, sized by hashopt */
+bufpool_get() {
+	if(readbuf.ptr != NULL)
+		return &readbuf;
+	if(bufpool_alloc(&readbuf, hashopt.bufsize, hashopt.hugepages) != 0)
+		return NULL;
+	return &readbuf;
+}
+
+void	/* called by a worker before it quits */
+bufpool_release() {
+	bufpool_free(&readbuf);
+}
@@ -0,0 +1,25 @@
+#ifndef __BUFPOOL_H__
+#define __BUFPOOL_H__
+
+#include <stddef.h>
+
+/* aligned i/o buffers, one read buffer per thread */
+
+#define	BUFPOOL_ALIGN	4096
+#define	BUFPOOL_HUGE_SIZE	(2<<20)
+#define	BUFPOOL_MIN_SIZE	BUFPOOL_ALIGN
+#define	BUFPOOL_MAX_SIZE	(256<<20)
+
+typedef struct buf_s {
+	char *ptr;
+	size_t size;	/* as requested, what reads may fill */
+	size_t maplen;	/* allocated bytes, rounded up to whole (huge) pages */
+	int mapped;	/* backed by an explicit huge page mapping */
+}	buf_t;
+
+int    bufpool_alloc(buf_t *buf, size_t size, int huge);
+void   bufpool_free(buf_t *buf);
+buf_t * bufpool_get();
+void   bufpool_release();
+
+#endif	/* __BUFPOOL_H__ */
@@ -0,0 +1,337 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include "hashsumr.h"
+#include "cache.h"
+
+typedef struct centry_s {
+	unsigned long long dev, ino, size;
+	long long mtime, ctime;	/* nanoseconds */
+	long long atime;	/* last run that used the entry, seconds */
+	char alg[CACHE_ALG_SIZE];	/* nul padded */
+	unsigned char hlen;
+	unsigned char pad[3];
+	unsigned char hash[CACHE_DIGEST_SIZE];
+}	centry_t;	/* 128 bytes */
+
+typedef struct chead_s {
+	char magic[8];	/* CACHE_MAGIC */
+	unsigned int esize;	/* sizeof(centry_t), rejects foreign layouts */
+	unsigned int reserved;
+	unsigned long long count;
+}	chead_t;
+
+typedef struct table_s {
+	void *map;
+	size_t mapsz;
+	const centry_t *e;	/* sorted by dev, ino, alg */
+	size_t n;
+}	table_t;
+
+struct cache_s {
+	char *path;
+	time_t now;
+	table_t snap;	/* the table when the cache was opened */
+	unsigned char *hit;	/* per snapshot entry */
+	pthread_mutex_t mutex;
+	centry_t *add;	/* digests computed in this run */
+	size_t nadd, szadd;
+};
+
+static int
+entry_cmp(const void *pa, const void *pb) {
+	const centry_t *a = (const centry_t *) pa, *b = (const centry_t *) pb;
+	if(a->dev != b->dev) return a->dev < b->dev ? -1 : 1;
+	if(a->ino != b->ino) return a->ino < b->ino ? -1 : 1;
+	return strncmp(a->alg, b->alg, CACHE_ALG_SIZE);
+}
+
+static int	/* 0 on success, an empty table if the file does not exist */
+table_map(const char *path, table_t *t) {
+	struct stat st;
+	const chead_t *h;
+	int fd, err;
+	memset(t, 0, sizeof(table_t));
+	if((fd = open(path, O_RDONLY)) < 0)
+		return errno == ENOENT ? 0 : errno;
+	if(fstat(fd, &st) < 0) {
+		err = errno;
+		close(fd);
+		return err;
+	}
+	if(st.st_size == 0) {
+		close(fd);
+		return 0;
+	}
+	if((size_t) st.st_size < sizeof(chead_t)) {
+		close(fd);
+		return EINVAL;
+	}
+	t->mapsz = st.st_size;
+	t->map = mmap(NULL, t->mapsz, PROT_READ, MAP_SHARED, fd, 0);
+	err = errno;
+	close(fd);
+	if(t->map == MAP_FAILED) {
+		t->map = NULL;
+		return err;
+	}
+	h = (const chead_t *) t->map;
+	if(memcmp(h->magic, CACHE_MAGIC, sizeof(h->magic)) != 0
+	|| h->esize != sizeof(centry_t)
+	|| h->count != (t->mapsz - sizeof(chead_t)) / sizeof(centry_t)
+	|| (t->mapsz - sizeof(chead_t)) % sizeof(centry_t) != 0) {
+		munmap(t->map, t->mapsz);
+		t->map = NULL;
+		return EINVAL;
+	}
+	t->e = (const centry_t *) (h + 1);
+	t->n = h->count;
+	return 0;
+}
+
+static void
+table_unmap(table_t *t) {
+	if(t->map != NULL)
+		munmap(t->map, t->mapsz);
+	memset(t, 0, sizeof(table_t));
+}
+
+cache_t *	/* NULL and errno if the file is not a cache, a missing file is an empty cache */
+cache_open(const char *path) {
+	cache_t *c;
+	int err;
+	if((c = (cache_t *) calloc(1, sizeof(cache_t))) == NULL)
+		return NULL;
+	if((c->path = strdup(path)) == NULL) {
+		err = ENOMEM;
+	} else if((err = table_map(path, &c->snap)) == 0
+	&& c->snap.n > 0 && (c->hit = (unsigned char *) calloc(c->snap.n, 1)) == NULL) {
+		err = ENOMEM;
+	}
+	if(err != 0) {
+		table_unmap(&c->snap);
+		free(c->path);
+		free(c);
+		errno = err;
+		return NULL;
+	}
+	c->now = time(NULL);
+	pthread_mutex_init(&c->mutex, NULL);
+	return c;
+}
+
+void
+cache_key(const struct stat *st, cachekey_t *key) {
+	key->dev = st->st_dev;
+	key->ino = st->st_ino;
+	key->size = st->st_size;
+	key->mtime = CACHE_MTIME_NS(st);
+	key->ctime = CACHE_CTIME_NS(st);
+}
+
+static int	/* fill the lookup fields of an entry, -1 if alg does not fit */
+entry_key(centry_t *e, const cachekey_t *key, const char *alg) {
+	if(strlen(alg) >= CACHE_ALG_SIZE)
+		return -1;
+	memset(e, 0, sizeof(centry_t));
+	e->dev = key->dev;
+	e->ino = key->ino;
+	e->size = key->size;
+	e->mtime = key->mtime;
+	e->ctime = key->ctime;
+	strncpy(e->alg, alg, CACHE_ALG_SIZE);
+	return 0;
+}
+
+int	/* 0 and the digest if the file has not changed since it was cached */
+cache_get(cache_t *c, const cachekey_t *key, const char *alg, unsigned char *hash, unsigned int *hlen) {
+	centry_t probe;
+	const centry_t *e;
+	if(c->snap.n == 0 || entry_key(&probe, key, alg) != 0)
+		return -1;
+	if((e = (const centry_t *) bsearch(&probe, c->snap.e, c->snap.n, sizeof(centry_t), entry_cmp)) == NULL)
+		return -1;
+	if(e->size != key->size || e->mtime != key->mtime || e->ctime != key->ctime
+	|| e->hlen > CACHE_DIGEST_SIZE)
+		return -1;
+	memcpy(hash, e->hash, e->hlen);
+	*hlen = e->hlen;
+	c->hit[e - c->snap.e] = 1;
+	return 0;
+}
+
+static int
+add_entry(cache_t *c, const centry_t *e) {
+	if(c->nadd >= c->szadd) {
+		size_t sz = c->szadd ? c->szadd * 2 : 4096;
+		centry_t *p;
+		if((p = (centry_t *) realloc(c->add, sz * sizeof(centry_t))) == NULL)
+			return -1;
+		c->add = p;
+		c->szadd = sz;
+	}
+	c->add[c->nadd++] = *e;
+	return 0;
+}
+
+int	/* remember a digest, thread-safe. -1 if it cannot be cached */
+cache_put(cache_t *c, const cachekey_t *key, const char *alg, const unsigned char *hash, unsigned int hlen) {
+	centry_t e;
+	long long racy = (long long) (c->now - CACHE_RACY) * 1000000000LL;
+	int err;
+	if(hlen > CACHE_DIGEST_SIZE || entry_key(&e, key, alg) != 0)
+		return -1;
+	/* a write in the same timestamp tick would not change the key */
+	if(key->mtime >= racy || key->ctime >= racy)
+		return -1;
+	e.atime = c->now;
+	e.hlen = (unsigned char) hlen;
+	memcpy(e.hash, hash, hlen);
+	pthread_mutex_lock(&c->mutex);
+	err = add_entry(c, &e);
+	pthread_mutex_unlock(&c->mutex);
+	return err;
+}
+
+static size_t	/* merge two sorted tables, b wins on equal keys. entries of a
+		 * last used before expire are dropped. out or fp receives the result */
+merge(const centry_t *a, size_t na, const centry_t *b, size_t nb, long long expire,
+		centry_t *out, FILE *fp) {
+	size_t i = 0, j = 0, n = 0;
+	const centry_t *e;
+	while(i < na || j < nb) {
+		int r = i >= na ? 1 : j >= nb ? -1 : entry_cmp(&a[i], &b[j]);
+		if(r < 0) {
+			e = &a[i++];
+			if(e->atime < expire) continue;
+		} else {
+			if(r == 0) i++;
+			e = &b[j++];
+		}
+		if(fp != NULL) {
+			if(fwrite(e, sizeof(centry_t), 1, fp) != 1)
+				return (size_t) -1;
+		} else {
+			out[n] = *e;
+		}
+		n++;
+	}
+	return n;
+}
+
+static int	/* merge the updates with the latest table into a new file. 0 or errno */
+cache_save(cache_t *c, const centry_t *upd, size_t nupd) {
+	table_t fresh;
+	chead_t head;
+	char *lock = NULL, *tmp = NULL;
+	FILE *fp = NULL;
+	size_t n, len = strlen(c->path);
+	int lfd = -1, fd = -1, err = 0;
+	if((lock = (char *) malloc(len + 8)) == NULL
+	|| (tmp = (char *) malloc(len + 8)) == NULL) {
+		err = ENOMEM;
+		goto done;
+	}
+	snprintf(lock, len + 8, "%s.lock", c->path);
+	snprintf(tmp, len + 8, "%s.XXXXXX", c->path);
+	/* other writers may have saved since we opened it */
+	if((lfd = open(lock, O_RDWR|O_CREAT, 0644)) < 0 || flock(lfd, LOCK_EX) < 0) {
+		err = errno;
+		goto done;
+	}
+	if((err = table_map(c->path, &fresh)) != 0)
+		goto done;
+	if((fd = mkstemp(tmp)) < 0 || (fp = fdopen(fd, "wb")) == NULL) {
+		err = errno;
+		table_unmap(&fresh);
+		goto done;
+	}
+	fchmod(fd, 0644);
+	memset(&head, 0, sizeof(head));
+	memcpy(head.magic, CACHE_MAGIC, sizeof(head.magic));
+	head.esize = sizeof(centry_t);
+	if(fwrite(&head, sizeof(head), 1, fp) != 1
+	|| (n = merge(fresh.e, fresh.n, upd, nupd, c->now - CACHE_EXPIRE, NULL, fp)) == (size_t) -1) {
+		err = errno ? errno : EIO;
+		table_unmap(&fresh);
+		goto done;
+	}
+	table_unmap(&fresh);
+	head.count = n;
+	if(fseek(fp, 0, SEEK_SET) != 0
+	|| fwrite(&head, sizeof(head), 1, fp) != 1
+	|| fflush(fp) != 0
+	|| fsync(fd) != 0) {
+		err = errno ? errno : EIO;
+		goto done;
+	}
+	fclose(fp);
+	fp = NULL;
+	if(rename(tmp, c->path) != 0)
+		err = errno;
+done:
+	if(fp != NULL) fclose(fp);
+	else if(fd >= 0) close(fd);
+	if(err != 0 && fd >= 0) unlink(tmp);
+	if(lfd >= 0) close(lfd);	/* releases the lock */
+	free(lock);
+	free(tmp);
+	return err;
+}
+
+int	/* save new digests and free the cache. 0 or errno */
+cache_close(cache_t *c) {
+	centry_t *touch = NULL, *upd = NULL;
+	size_t i, j, ntouch = 0, nupd;
+	int err = 0;
+	if(c == NULL)
+		return 0;
+	/* sort this run's digests, one per key */
+	if(c->nadd > 0) {
+		qsort(c->add, c->nadd, sizeof(centry_t), entry_cmp);
+		for(i = 1, j = 0; i < c->nadd; i++) {
+			if(entry_cmp(&c->add[j], &c->add[i]) != 0) j++;
+			c->add[j] = c->add[i];
+		}
+		c->nadd = j + 1;
+	}
+	/* hits keep their entries from expiring */
+	for(i = 0; i < c->snap.n; i++) {
+		if(c->hit[i] && c->snap.e[i].atime < c->now - CACHE_TOUCH) ntouch++;
+	}
+	if(ntouch > 0 && (touch = (centry_t *) malloc(ntouch * sizeof(centry_t))) != NULL) {
+		for(i = 0, j = 0; i < c->snap.n; i++) {
+			if(c->hit[i] && c->snap.e[i].atime < c->now - CACHE_TOUCH) {
+				touch[j] = c->snap.e[i];
+				touch[j++].atime = c->now;
+			}
+		}
+	} else {
+		ntouch = 0;
+	}
+	if(ntouch + c->nadd > 0) {
+		if(ntouch == 0) {
+			err = cache_save(c, c->add, c->nadd);
+		} else if((upd = (centry_t *) malloc((ntouch + c->nadd) * sizeof(centry_t))) == NULL) {
+			err = ENOMEM;
+		} else {
+			nupd = merge(touch, ntouch, c->add, c->nadd, 0, upd, NULL);
+			err = cache_save(c, upd, nupd);
+		}
+	}
+	free(upd);
+	free(touch);
+	free(c->add);
+	free(c->hit);
+	table_unmap(&c->snap);
+	pthread_mutex_destroy(&c->mutex);
+	free(c->path);
+	free(c);
+	return err;
+}
@@ -0,0 +1,42 @@
+#ifndef __CACHE_H__
+#define __CACHE_H__
+
+/* persistent digest cache for incremental runs, posix only.
+ * the cache file is a sorted table of fixed-size entries, mapped
+ * read-only and searched in place. new digests are merged into a new
+ * file that replaces the old one with rename(2) when the cache is
+ * closed, so readers never see a partial file. writers are serialized
+ * by a lock file and merge with the latest table */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#define	CACHE_MAGIC	"HSUMRC01"
+#define	CACHE_DIGEST_SIZE	64	/* longer digests are not cached */
+#define	CACHE_ALG_SIZE	12
+#define	CACHE_EXPIRE	(30*86400)	/* entries unused for this long are dropped */
+#define	CACHE_TOUCH	86400	/* refresh the last use of hits at most once a day */
+#define	CACHE_RACY	2	/* seconds, files modified since are not cached */
+
+#ifdef __APPLE__
+#define	CACHE_MTIME_NS(st)	((long long) (st)->st_mtimespec.tv_sec * 1000000000LL + (st)->st_mtimespec.tv_nsec)
+#define	CACHE_CTIME_NS(st)	((long long) (st)->st_ctimespec.tv_sec * 1000000000LL + (st)->st_ctimespec.tv_nsec)
+#else
+#define	CACHE_MTIME_NS(st)	((long long) (st)->st_mtim.tv_sec * 1000000000LL + (st)->st_mtim.tv_nsec)
+#define	CACHE_CTIME_NS(st)	((long long) (st)->st_ctim.tv_sec * 1000000000LL + (st)->st_ctim.tv_nsec)
+#endif
+
+typedef struct cachekey_s {
+	unsigned long long dev, ino, size;
+	long long mtime, ctime;	/* nanoseconds */
+}	cachekey_t;
+
+typedef struct cache_s cache_t;
+
+cache_t * cache_open(const char *path);
+int    cache_get(cache_t *c, const cachekey_t *key, const char *alg, unsigned char *hash, unsigned int *hlen);
+int    cache_put(cache_t *c, const cachekey_t *key, const char *alg, const unsigned char *hash, unsigned int hlen);
+void   cache_key(const struct stat *st, cachekey_t *key);
+int    cache_close(cache_t *c);
+
+#endif	/* __CACHE_H__ */
@@ -0,0 +1,289 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __linux__
+#include <sys/sysmacros.h>
+#endif
+#include "hashsumr.h"
+#include "jobstore.h"
+#include "dispatch.h"
+
+void
+dispatch_init(dispatch_t *d, int njobs, int nworkers) {
+	memset(d, 0, sizeof(dispatch_t));
+	d->njobs = njobs;
+	d->nworkers = nworkers > 0 ? nworkers : 1;
+	pthread_mutex_init(&d->mutex, NULL);
+	pthread_cond_init(&d->cond, NULL);
+}
+
+void	/* jobs will be published by dispatch_publish() until dispatch_close() */
+dispatch_stream(dispatch_t *d) {
+	d->open = 1;
+}
+
+void	/* jobs [0, njobs) are ready, called by the producer */
+dispatch_publish(dispatch_t *d, int njobs) {
+	pthread_mutex_lock(&d->mutex);
+	ATOMIC_STORE(&d->njobs, njobs);
+	pthread_cond_broadcast(&d->cond);
+	pthread_mutex_unlock(&d->mutex);
+}
+
+void	/* no more jobs */
+dispatch_close(dispatch_t *d) {
+	pthread_mutex_lock(&d->mutex);
+	d->open = 0;
+	pthread_cond_broadcast(&d->cond);
+	pthread_mutex_unlock(&d->mutex);
+}
+
+static int	/* wait until job idx is published, 0 if it never will be */
+dispatch_wait(dispatch_t *d, int idx) {
+	int ok;
+	pthread_mutex_lock(&d->mutex);
+	while(idx >= d->njobs && d->open)
+		pthread_cond_wait(&d->cond, &d->mutex);
+	ok = idx < d->njobs;
+	pthread_mutex_unlock(&d->mutex);
+	return ok;
+}
+
+void
+dispatch_batch_init(batch_t *b) {
+	b->first = b->count = 0;
+	b->size = 1;
+}
+
+static int	/* claim one job whose device has a free slot, wait if there is none */
+dispatch_next_device(dispatch_t *d) {
+	device_t *dv;
+	int i, idx = -1;
+	pthread_mutex_lock(&d->mutex);
+	while(idx < 0) {
+		/* deferred jobs first, they were claimed earlier */
+		for(i = 0; d->deferred > 0 && i < d->ndevices; i++) {
+			dv = &d->devices[i];
+			if(dv->qhead < dv->qtail && dv->inflight < dv->limit) {
+				idx = dv->queue[dv->qhead++];
+				d->deferred--;
+				break;
+			}
+		}
+		/* then new jobs, deferring those whose device is busy */
+		while(idx < 0 && d->next < d->njobs) {
+			dv = &d->devices[d->devof[d->next]];
+			if(dv->limit == 0 || dv->inflight < dv->limit) {
+				idx = d->next++;
+				break;
+			}
+			dv->queue[dv->qtail++] = d->next++;
+			d->deferred++;
+		}
+		if(idx >= 0) {
+			d->devices[d->devof[idx]].inflight++;
+		} else if(d->deferred == 0) {
+			break;
+		} else {
+			/* every deferred device is at its limit, a running job will free a slot */
+			pthread_cond_wait(&d->cond, &d->mutex);
+		}
+	}
+	pthread_mutex_unlock(&d->mutex);
+	return idx;
+}
+
+int	/* return the next job index of this worker, or -1 if all jobs are claimed */
+dispatch_next(dispatch_t *d, batch_t *b) {
+	int size, left;
+	if(d->ndevices > 0)
+		return dispatch_next_device(d);
+	if(b->count == 0) {
+		/* guided: never claim more than a fair share of what is left */
+		left = ATOMIC_LOAD(&d->njobs) - d->next;
+		if(left <= 0 && d->open == 0 && dispatch_wait(d, d->next) == 0)
+			return -1;
+		size = left / (d->nworkers * 4);
+		if(size > b->size) size = b->size;
+		if(size < 1) size = 1;
+		/* claimed jobs not published yet are still ours, wait for them below */
+		b->first = ATOMIC_ADD(&d->next, size);
+		b->count = size;
+	}
+	if(b->first >= ATOMIC_LOAD(&d->njobs) && dispatch_wait(d, b->first) == 0) {
+		b->count = 0;
+		return -1;
+	}
+	b->count--;
+	return b->first++;
+}
+
+int	/* 1 if dispatch_next() has a job of this worker's batch without waiting */
+dispatch_ready(dispatch_t *d, batch_t *b) {
+	return d->ndevices == 0 && b->count > 0 && b->first < ATOMIC_LOAD(&d->njobs);
+}
+
+void	/* grow batches while files are small, hand out large files one by one */
+dispatch_feedback(batch_t *b, unsigned long long filesz) {
+	if(filesz >= DISPATCH_LARGE_FILE) {
+		b->size = 1;
+	} else if(b->size < DISPATCH_MAX_BATCH) {
+		b->size <<= 1;
+	}
+}
+
+void	/* a job returned by dispatch_next() is finished */
+dispatch_done(dispatch_t *d, int idx) {
+	if(d->ndevices == 0)
+		return;
+	pthread_mutex_lock(&d->mutex);
+	d->devices[d->devof[idx]].inflight--;
+	if(d->deferred > 0)
+		pthread_cond_broadcast(&d->cond);
+	pthread_mutex_unlock(&d->mutex);
+}
+
+static int	/* 1 if dev is on a rotational disk, 0 if not or unknown */
+device_rotational(unsigned long long dev) {
+#ifdef __linux__
+	char path[128];
+	FILE *fp;
+	int rot = 0;
+	snprintf(path, sizeof(path), "/sys/dev/block/%u:%u/queue/rotational",
+		major(dev), minor(dev));
+	if((fp = fopen(path, "r")) == NULL) {
+		/* a partition, ask its disk */
+		snprintf(path, sizeof(path), "/sys/dev/block/%u:%u/../queue/rotational",
+			major(dev), minor(dev));
+		fp = fopen(path, "r");
+	}
+	if(fp != NULL) {
+		if(fscanf(fp, "%d", &rot) != 1) rot = 0;
+		fclose(fp);
+	}
+	return rot > 0;
+#else
+	(void) dev;
+	return 0;
+#endif
+}
+
+int	/* cap concurrent jobs per device, devs[] is the device of each job index.
+	 * limit > 0 applies to every device, DISPATCH_AUTO decides by device type.
+	 * return # of limited devices (limits are dropped if none), -1 on failure */
+dispatch_limit_devices(dispatch_t *d, const unsigned long long *devs, int limit) {
+	device_t *dv;
+	int i, j = 0, nlimited = 0;
+	if(d->njobs <= 0)
+		return 0;
+	if((d->devof = (int *) malloc(sizeof(int) * d->njobs)) == NULL)
+		return -1;
+	if((d->devices = (device_t *) calloc(d->njobs, sizeof(device_t))) == NULL)
+		goto failed;
+	for(i = 0; i < d->njobs; i++) {
+		/* consecutive jobs are mostly on the same device */
+		if(d->ndevices == 0 || d->devices[j].dev != devs[i]) {
+			for(j = 0; j < d->ndevices; j++) {
+				if(d->devices[j].dev == devs[i]) break;
+			}
+			if(j == d->ndevices)
+				d->devices[d->ndevices++].dev = devs[i];
+		}
+		d->devof[i] = j;
+		d->devices[j].qtail++;	/* count jobs for the queue size */
+	}
+	for(i = 0; i < d->ndevices; i++) {
+		dv = &d->devices[i];
+		if(limit == DISPATCH_AUTO) {
+			dv->limit = device_rotational(dv->dev) ? 1 : 0;
+		} else {
+			dv->limit = limit;
+		}
+		if(dv->limit == 0 || dv->limit >= d->nworkers) {
+			dv->limit = 0;
+		} else {
+			if((dv->queue = (int *) malloc(sizeof(int) * dv->qtail)) == NULL)
+				goto failed;
+			nlimited++;
+		}
+		dv->qtail = 0;
+	}
+	if(nlimited == 0) {
+		/* nothing to cap, keep the lock-free path */
+		dispatch_free(d);
+		return 0;
+	}
+	return nlimited;
+failed:
+	dispatch_free(d);
+	return -1;
+}
+
+int	/* 1 if the job is on a device with a limit */
+dispatch_limited(dispatch_t *d, int idx) {
+	if(d->ndevices == 0)
+		return 0;
+	return d->devices[d->devof[idx]].limit > 0;
+}
+
+void
+dispatch_free(dispatch_t *d) {
+	int i;
+	if(d->devices != NULL) {
+		for(i = 0; i < d->ndevices; i++)
+			free(d->devices[i].queue);
+		free(d->devices);
+		d->devices = NULL;
+	}
+	if(d->devof != NULL) {
+		free(d->devof);
+		d->devof = NULL;
+	}
+	d->ndevices = 0;
+}
+
+typedef struct sizeidx_s {
+	unsigned long long size;
+	int idx;
+}	sizeidx_t;
+
+static int
+cmp_largest_first(const void *a, const void *b) {
+	const sizeidx_t *x = (const sizeidx_t *) a, *y = (const sizeidx_t *) b;
+	if(x->size != y->size) return x->size < y->size ? 1 : -1;
+	return x->idx - y->idx;	/* stable */
+}
+
+int *	/* job indices in the order to dispatch them, NULL means input order.
+	 * the jobs' filesz must be filled in. */
+dispatch_order(jobstore_t *jobs, int policy) {
+	sizeidx_t *si;
+	int *order, i, n = 0, njobs = jobs->count;
+	if(policy == SCHED_INPUT || njobs <= 1)
+		return NULL;
+	if((si = (sizeidx_t *) malloc(sizeof(sizeidx_t) * njobs)) == NULL)
+		return NULL;
+	if((order = (int *) malloc(sizeof(int) * njobs)) == NULL) {
+		free(si);
+		return NULL;
+	}
+	for(i = 0; i < njobs; i++) {
+		if(policy == SCHED_SIZE_BALANCED && JOBSTORE_AT(jobs, i)->filesz < DISPATCH_LARGE_FILE)
+			continue;
+		si[n].size = JOBSTORE_AT(jobs, i)->filesz;
+		si[n].idx = i;
+		n++;
+	}
+	qsort(si, n, sizeof(sizeidx_t), cmp_largest_first);
+	for(i = 0; i < n; i++)
+		order[i] = si[i].idx;
+	if(policy == SCHED_SIZE_BALANCED) {
+		/* small files keep their (usually directory) order for locality */
+		for(i = 0; i < njobs; i++) {
+			if(JOBSTORE_AT(jobs, i)->filesz < DISPATCH_LARGE_FILE)
+				order[n++] = i;
+		}
+	}
+	free(si);
+	return order;
+}
@@ -0,0 +1,65 @@
+#ifndef __DISPATCH_H__
+#define __DISPATCH_H__
+
+/* lock-free job dispatcher: workers claim batches of job indices.
+ * jobs may also be published while workers run (see dispatch_stream) */
+
+#include "hashsumr.h"
+#include "jobstore.h"
+
+#define	DISPATCH_MAX_BATCH	64
+#define	DISPATCH_LARGE_FILE	(1ULL<<20)	/* files this large are claimed one by one */
+#define	DISPATCH_AUTO		-1	/* per-device limit: 1 for rotational disks, none otherwise */
+
+enum {	// schedule policies
+	SCHED_INPUT = 0,	// argv/manifest order
+	SCHED_LARGEST_FIRST,	// all files by size, largest first
+	SCHED_SIZE_BALANCED,	// large files largest first, then small files in input order
+};
+
+typedef struct device_s {
+	unsigned long long dev;
+	int limit;	/* max concurrent jobs, 0 for unlimited */
+	int inflight;
+	int *queue;	/* jobs deferred until a slot is free, [qhead, qtail) */
+	int qhead;
+	int qtail;
+}	device_t;
+
+typedef struct dispatch_s {
+	char pad0[64];
+	volatile int next;	/* next unclaimed job, on a cache line of its own */
+	char pad1[64];
+	volatile int njobs;	/* # of published jobs */
+	int nworkers;
+	int open;	/* more jobs may be published */
+	/* per-device limits, jobs are claimed under the mutex if ndevices > 0 */
+	int ndevices;
+	device_t *devices;
+	int *devof;	/* device of each job */
+	int deferred;	/* # of jobs in device queues */
+	pthread_mutex_t mutex;	/* for waiting on devices or published jobs */
+	pthread_cond_t cond;
+}	dispatch_t;
+
+typedef struct batch_s {	/* per-worker state */
+	int first;	/* claimed jobs are [first, first+count) */
+	int count;
+	int size;	/* size of the next claim */
+}	batch_t;
+
+void dispatch_init(dispatch_t *d, int njobs, int nworkers);
+void dispatch_batch_init(batch_t *b);
+int  dispatch_next(dispatch_t *d, batch_t *b);
+int  dispatch_ready(dispatch_t *d, batch_t *b);
+void dispatch_feedback(batch_t *b, unsigned long long filesz);
+void dispatch_done(dispatch_t *d, int idx);
+void dispatch_stream(dispatch_t *d);
+void dispatch_publish(dispatch_t *d, int njobs);
+void dispatch_close(dispatch_t *d);
+int  dispatch_limit_devices(dispatch_t *d, const unsigned long long *devs, int limit);
+int  dispatch_limited(dispatch_t *d, int idx);
+void dispatch_free(dispatch_t *d);
+int * dispatch_order(jobstore_t *jobs, int policy);
+
+#endif	/* __DISPATCH_H__ */
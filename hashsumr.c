@@ -7,22 +7,33 @@
 #ifdef _WIN32
 #include <io.h>
 #else
+#include <time.h>
 #include <unistd.h>
+#include <sys/mman.h>
 #endif
 #include "hashsumr.h"
+#ifndef _WIN32
+#include "cache.h"
+#endif
 #ifdef _WIN32
 #include "wrappers-win32.h"
 #else
 #include "wrappers-openssl.h"
 #endif
 #include "wrappers-blake3.h"
+#include "uring.h"
+#include "bufpool.h"
+#include "hex.h"
+#include "stream.h"
+#include "stats.h"
+#include "mbhash.h"
 
 /* available algorithms */
-#define OPENSSL_TYPICAL	openssl_new, openssl_init, openssl_free, openssl_update, openssl_final
-#define OPENSSL_XOF32	openssl_new, openssl_init, openssl_free, openssl_update, openssl_final_xof32
-#define OPENSSL_XOF64	openssl_new, openssl_init, openssl_free, openssl_update, openssl_final_xof64
+#define OPENSSL_TYPICAL	openssl_new, openssl_init, openssl_free, openssl_update, openssl_final, openssl_reset
+#define OPENSSL_XOF32	openssl_new, openssl_init, openssl_free, openssl_update, openssl_final_xof32, openssl_reset
+#define OPENSSL_XOF64	openssl_new, openssl_init, openssl_free, openssl_update, openssl_final_xof64, openssl_reset
 
-#define BCRYPT_TYPICAL	bcrypt_new, bcrypt_init, bcrypt_free, bcrypt_update, bcrypt_final
+#define BCRYPT_TYPICAL	bcrypt_new, bcrypt_init, bcrypt_free, bcrypt_update, bcrypt_final, bcrypt_reset
 
 md_t algs[] = {
 #ifdef _WIN32
@@ -37,31 +48,59 @@ md_t algs[] = {
 	{ "SHAKE128",	BCRYPT_SHAKE128_ALGORITHM, BCRYPT_TYPICAL },
 	{ "SHAKE256",	BCRYPT_SHAKE256_ALGORITHM, BCRYPT_TYPICAL },
 #else
-	{ "SHA1",	EVP_sha1, OPENSSL_TYPICAL },
-	{ "SHA224",	EVP_sha224, OPENSSL_TYPICAL },
-	{ "SHA256",	EVP_sha256, OPENSSL_TYPICAL },
-	{ "SHA384",	EVP_sha384, OPENSSL_TYPICAL },
-	{ "SHA512",	EVP_sha512, OPENSSL_TYPICAL },
-	{ "SHA512/224",	EVP_sha512_224, OPENSSL_TYPICAL },
-	{ "SHA512/256",	EVP_sha512_256, OPENSSL_TYPICAL },
-	{ "SHA3/224",	EVP_sha3_224, OPENSSL_TYPICAL },
-	{ "SHA3/256",	EVP_sha3_256, OPENSSL_TYPICAL },
-	{ "SHA3/384",	EVP_sha3_384, OPENSSL_TYPICAL },
-	{ "SHA3/512",	EVP_sha3_512, OPENSSL_TYPICAL },
-	{ "SHAKE128",	EVP_shake128, OPENSSL_XOF32 },
-	{ "SHAKE256",	EVP_shake256, OPENSSL_XOF64 },
+	{ "SHA1",	EVPMD("SHA1", EVP_sha1), OPENSSL_TYPICAL },
+	{ "SHA224",	EVPMD("SHA224", EVP_sha224), OPENSSL_TYPICAL },
+	{ "SHA256",	EVPMD("SHA256", EVP_sha256), OPENSSL_TYPICAL },
+	{ "SHA384",	EVPMD("SHA384", EVP_sha384), OPENSSL_TYPICAL },
+	{ "SHA512",	EVPMD("SHA512", EVP_sha512), OPENSSL_TYPICAL },
+	{ "SHA512/224",	EVPMD("SHA512-224", EVP_sha512_224), OPENSSL_TYPICAL },
+	{ "SHA512/256",	EVPMD("SHA512-256", EVP_sha512_256), OPENSSL_TYPICAL },
+	{ "SHA3/224",	EVPMD("SHA3-224", EVP_sha3_224), OPENSSL_TYPICAL },
+	{ "SHA3/256",	EVPMD("SHA3-256", EVP_sha3_256), OPENSSL_TYPICAL },
+	{ "SHA3/384",	EVPMD("SHA3-384", EVP_sha3_384), OPENSSL_TYPICAL },
+	{ "SHA3/512",	EVPMD("SHA3-512", EVP_sha3_512), OPENSSL_TYPICAL },
+	{ "SHAKE128",	EVPMD("SHAKE128", EVP_shake128), OPENSSL_XOF32 },
+	{ "SHAKE256",	EVPMD("SHAKE256", EVP_shake256), OPENSSL_XOF64 },
 #ifndef OPENSSL_NO_MD5
-	{ "MD5",	EVP_md5,    OPENSSL_TYPICAL },
+	{ "MD5",	EVPMD("MD5", EVP_md5), OPENSSL_TYPICAL },
 #endif
 #ifndef OPENSSL_NO_BLAKE2
-	{ "BLAKE2b", EVP_blake2b512,  OPENSSL_TYPICAL },
-	{ "BLAKE2s", EVP_blake2s256,  OPENSSL_TYPICAL },
+	{ "BLAKE2b", EVPMD("BLAKE2B-512", EVP_blake2b512), OPENSSL_TYPICAL },
+	{ "BLAKE2s", EVPMD("BLAKE2S-256", EVP_blake2s256), OPENSSL_TYPICAL },
 #endif
 #endif
-	{ "BLAKE3",  NULL, blake3_new, blake3_init, blake3_free, blake3_update, blake3_final },
+	{ "BLAKE3",  NULL, blake3_new, blake3_init, blake3_free, blake3_update, blake3_final, blake3_reset },
 	{ NULL, NULL }
 };
 
+hashopt_t hashopt = { IOENGINE_READ, 8, HASHSUMR_BUFSIZE, 0, 0, 0, NULL, 0, NULL, 0 };
+
+#define	NALGS	(sizeof(algs) / sizeof(md_t))
+static md_t *algrefs[NALGS];	/* md_ref() slots, the last one stays NULL */
+static THREAD_LOCAL ctx_t *ctxpool[NALGS];	/* a spare context per algorithm, per thread */
+
+/* interned error messages, jobs only keep a pointer */
+static pthread_mutex_t mutex_intern = PTHREAD_MUTEX_INITIALIZER;
+static char **interned = NULL;
+static size_t ninterned = 0, szinterned = 0;
+
+/* a large blake3 file split into subtrees, hashed by its owner and idle workers */
+typedef struct split_s {
+	job_t *job;
+	unsigned long long fsize;
+	size_t npieces;
+	size_t next;	/* next piece to claim */
+	size_t done;	/* # of finished pieces */
+	int err;	/* errno of the first failed piece */
+	unsigned char *cvs;	/* chaining value of each piece */
+	pthread_cond_t cond;	/* signaled when all pieces are done */
+	struct split_s *link;
+}	split_t;
+
+static pthread_mutex_t mutex_split = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  cond_split = PTHREAD_COND_INITIALIZER;
+static split_t *splits = NULL;
+
 char *	/* should be thread-safe */
 herrmsg(char *buf, size_t sz, int errnum) {
 #ifdef _WIN32
@@ -92,31 +131,105 @@ lookup_hash(const char *name) {
 	return NULL;
 }
 
+md_t **	/* a one-algorithm list for job->md that lives as long as the program */
+md_ref(md_t *md) {
+	md_t **ref;
+	if(md == NULL)
+		return &algrefs[NALGS - 1];
+	ref = &algrefs[md - algs];
+	if(*ref != md) *ref = md;
+	return ref;
+}
+
 char *
 digest(unsigned char *hash, unsigned int hlen, char *digest, unsigned int dlen) {
-	unsigned int i;
-	int sz, clen = 0;
-	char *wptr = digest;
-	for (i = 0; i < hlen; i++) {
-		sz = snprintf(wptr, dlen-clen, "%02x", hash[i]);
-		clen += sz;
-		wptr += sz;
-	}
+	if(hex_encode(hash, hlen, digest, dlen) < 0 && dlen > 0)
+		digest[0] = '\0';
 	return digest;
 }
 
+static size_t
+intern_hash(const char *s) {
+	size_t h = 2166136261u;	/* fnv-1a */
+	while(*s) h = (h ^ (unsigned char) *s++) * 16777619u;
+	return h;
+}
+
+static const char *	/* the one copy of a message, messages are few and never freed */
+intern(const char *msg) {
+	size_t i, h;
+	char **old, *copy;
+	pthread_mutex_lock(&mutex_intern);
+	if(ninterned * 2 >= szinterned) {
+		size_t osz = szinterned, nsz = szinterned ? szinterned * 2 : 64;
+		old = interned;
+		if((interned = (char **) calloc(nsz, sizeof(char *))) == NULL) {
+			interned = old;
+			pthread_mutex_unlock(&mutex_intern);
+			return "out of memory";
+		}
+		szinterned = nsz;
+		for(i = 0; i < osz; i++) {
+			if(old[i] == NULL) continue;
+			for(h = intern_hash(old[i]) & (nsz - 1); interned[h] != NULL; h = (h + 1) & (nsz - 1))
+				;
+			interned[h] = old[i];
+		}
+		free(old);
+	}
+	for(h = intern_hash(msg) & (szinterned - 1); interned[h] != NULL; h = (h + 1) & (szinterned - 1)) {
+		if(strcmp(interned[h], msg) == 0) {
+			pthread_mutex_unlock(&mutex_intern);
+			return interned[h];
+		}
+	}
+	if((copy = strdup(msg)) == NULL) {
+		pthread_mutex_unlock(&mutex_intern);
+		return "out of memory";
+	}
+	interned[h] = copy;
+	ninterned++;
+	pthread_mutex_unlock(&mutex_intern);
+	return copy;
+}
+
 long
 jobstate(job_t *job, long code, const char *fmt, ...) {
+	char msg[ERRMSG_SIZE];
 	va_list ap;
-	job->code = code;
 	va_start(ap, fmt);
-	vsnprintf(job->errmsg, ERRMSG_SIZE, fmt, ap);
+	vsnprintf(msg, sizeof(msg), fmt, ap);
 	va_end(ap);
+	job->errmsg = intern(msg);
+	job->code = (unsigned char) code;
 	return code;
 }
 
+unsigned char *	/* the idx-th digest of a job */
+job_hash(job_t *job, int idx) {
+	unsigned char *h = job->xhash != NULL ? job->xhash : job->hash;
+	int i;
+	for(i = 0; i < idx; i++)
+		h += job->hashlen[i];
+	return h;
+}
+
+int	/* store the idx-th digest, in order of idx. 0 on success */
+job_sethash(job_t *job, int idx, const unsigned char *hash, unsigned int hlen) {
+	size_t off = job_hash(job, idx) - (job->xhash != NULL ? job->xhash : job->hash);
+	if(job->xhash == NULL && off + hlen > HASHSUMR_JOB_HASH) {
+		/* only for several long digests, freed with the job store */
+		if((job->xhash = (unsigned char *) malloc(HASHSUMR_MAX_ALGS * EVP_MAX_MD_SIZE)) == NULL)
+			return -1;
+		memcpy(job->xhash, job->hash, off);
+	}
+	memcpy(job_hash(job, idx), hash, hlen);
+	job->hashlen[idx] = (unsigned char) hlen;
+	return 0;
+}
+
 int
-get_fileinfo(const TCHAR *filename, unsigned long long *sz, int *type) {
+get_fileinfo(const TCHAR *filename, unsigned long long *sz, int *type, unsigned long long *dev) {
 #ifdef _WIN32
 	WIN32_FILE_ATTRIBUTE_DATA fileInfo;
 	LARGE_INTEGER li;
@@ -134,6 +247,7 @@ get_fileinfo(const TCHAR *filename, unsigned long long *sz, int *type) {
 	li.HighPart = fileInfo.nFileSizeHigh;
 	li.LowPart  = fileInfo.nFileSizeLow;
 	*sz = li.QuadPart;
+	if(dev != NULL) *dev = 0;	/* unknown */
 	if(fileInfo.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
 		*type = S_IFDIR;
 	} else if(fileInfo.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) {
@@ -146,6 +260,7 @@ get_fileinfo(const TCHAR *filename, unsigned long long *sz, int *type) {
 	if(stat(filename, &st) < 0)
 		return errno;
 	*sz = st.st_size;
+	if(dev != NULL) *dev = st.st_dev;
 	if(S_ISREG(st.st_mode)) {
 		*type = S_IFREG;
 	} else if(S_ISDIR(st.st_mode)) {
@@ -161,40 +276,484 @@ get_fileinfo(const TCHAR *filename, unsigned long long *sz, int *type) {
 	return 0;
 }
 
-void *
-hash1(job_t *job, visualizer_t vzer, void *varg) {
-	int fd = -1, sz;
-	char buf[32768];
-	ctx_t *ctx = NULL;
+static ctx_t *	/* a spare context of the thread, or a new one */
+ctx_get(md_t *md) {
+	size_t i = md - algs;
+	ctx_t *ctx;
+	if(i < NALGS && (ctx = ctxpool[i]) != NULL) {
+		ctxpool[i] = NULL;
+		return ctx;
+	}
+	return md->fnew();
+}
+
+static void	/* keep a context for the next file, files hashed with
+		 * several algorithms need one spare of each */
+ctx_put(md_t *md, ctx_t *ctx) {
+	size_t i = md - algs;
+	if(i < NALGS && ctxpool[i] == NULL && (md->freset == NULL || md->freset(ctx) == 1)) {
+		ctxpool[i] = ctx;
+		return;
+	}
+	md->ffree(ctx);
+}
+
+/* --multi-buffer: hash_file() reads a small sha-256 file whole into a
+ * slot of its thread and leaves the job STATE_PENDING, hash_flush()
+ * hashes the gathered files side by side and finishes their jobs */
+typedef struct gathered_s {
+	job_t *job;
+	size_t len;
+	filestat_t fs;
+	int timed;	/* fs is set, stats_file() waits for the digest */
+#ifndef _WIN32
+	cachekey_t key;
+	int cached;
+	unsigned char chash[HASHSUMR_MAX_ALGS][CACHE_DIGEST_SIZE];
+	unsigned int chlen[HASHSUMR_MAX_ALGS];
+#endif
+}	gathered_t;
+
+static THREAD_LOCAL gathered_t *gathered;	/* MBHASH_JOBS slots */
+static THREAD_LOCAL unsigned char *gatherbuf;	/* MBHASH_MAX bytes per slot */
+static THREAD_LOCAL int ngathered;
+
+void	/* called by a thread before it quits, frees its spare contexts and its stream reader */
+hash_release() {
+	size_t i;
+	for(i = 0; i < NALGS; i++) {
+		if(ctxpool[i] == NULL) continue;
+		algs[i].ffree(ctxpool[i]);
+		ctxpool[i] = NULL;
+	}
+	stream_release();
+	free(gathered);
+	free(gatherbuf);
+	gathered = NULL;
+	gatherbuf = NULL;
+	ngathered = 0;
+}
+
+typedef struct feed_s {
+	job_t *job;
+	ctx_t **ctx;
+	visualizer_t vzer;
+	void *varg;
+	filestat_t *fs;	/* --stats, or NULL */
+}	feed_t;
+
+int	/* pass a block to all the algorithms of a job, 0 on success */
+hash_update(void *buf, size_t len, void *arg) {
+	feed_t *f = (feed_t *) arg;
+	unsigned long long t = f->fs != NULL ? stats_now() : 0;
+	int i;
+	for(i = 0; i < f->job->nmd; i++) {
+		if(f->job->md[i]->fupdate(f->ctx[i], buf, len) != 1) {
+			jobstate(f->job, ERR_UPDATE, "hash update failed (%s)", f->job->md[i]->name);
+			return -1;
+		}
+	}
+	if(f->fs != NULL) {
+		f->fs->hash += stats_now() - t;
+		f->fs->bytes += len;
+	}
+	f->job->checked += len;
+	if(f->vzer != NULL) f->vzer(f->job, f->varg);
+	return 0;
+}
+
+#ifndef _WIN32
+long	/* feed mapped windows of a file, stops early (for read fallback) if mmap fails or the file shrinks */
+hash_mmap(job_t *job, int fd, feed_t *feed) {
+	struct stat st;
+	unsigned long long off = 0, fsize;
+	size_t len, wlen, step = 1<<20;
+	char *addr, *wptr;
+	while(1) {
+		if(fstat(fd, &st) < 0) break;
+		fsize = st.st_size;
+		if(fsize <= off) break;
+		len = (fsize - off) > HASHSUMR_MMAP_WINDOW ? HASHSUMR_MMAP_WINDOW : (size_t) (fsize - off);
+		if((addr = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, (off_t) off)) == MAP_FAILED) break;
+#ifdef MADV_SEQUENTIAL
+		madvise(addr, len, MADV_SEQUENTIAL);
+#endif
+#ifdef MADV_WILLNEED
+		madvise(addr, len, MADV_WILLNEED);
+#endif
+		for(wptr = addr; wptr < addr + len; wptr += wlen) {
+			wlen = (size_t) (addr + len - wptr) > step ? step : (size_t) (addr + len - wptr);
+			if(hash_update(wptr, wlen, feed) != 0) {
+				munmap(addr, len);
+				return job->code;
+			}
+		}
+		munmap(addr, len);
+		off += len;
+	}
+	return STATE_UNKNOWN;
+}
+#endif
+
+int	/* hash one subtree of a split file with its own descriptor, 0 or errno */
+hash_piece(split_t *sp, size_t idx) {
+	int fd = -1, oflags = O_RDONLY, err = 0;
+	unsigned long long off = idx * HASHSUMR_SPLIT_SIZE;
+	size_t len, rlen;
+	long long sz;
+	blake3_hasher hasher;
+	buf_t *buf;
+	len = (sp->fsize - off) > HASHSUMR_SPLIT_SIZE ? HASHSUMR_SPLIT_SIZE : (size_t) (sp->fsize - off);
+	if((buf = bufpool_get()) == NULL)
+		return ENOMEM;
+#ifdef _WIN32
+	if(_wsopen_s(&fd, sp->job->wfilename, O_RDONLY|_O_BINARY, _SH_DENYWR, _S_IREAD) != 0)
+		return errno;
+	if(_lseeki64(fd, off, SEEK_SET) < 0) {
+#else
+#ifdef O_DIRECT
+	if(hashopt.direct) oflags |= O_DIRECT;
+#endif
+	if((fd = open(sp->job->filename, oflags)) < 0 && oflags != O_RDONLY && errno == EINVAL) {
+		oflags = O_RDONLY;
+		fd = open(sp->job->filename, oflags);
+	}
+	if(fd < 0)
+		return errno;
+	if(lseek(fd, (off_t) off, SEEK_SET) < 0) {
+#endif
+		err = errno;
+		goto quit;
+	}
+	blake3_subtree_init(&hasher, off);
+	while(len > 0) {
+		/* keep the request aligned for O_DIRECT, the tail just reads less */
+		rlen = len > buf->size ? buf->size : (len + BUFPOOL_ALIGN - 1) & ~((size_t) BUFPOOL_ALIGN - 1);
+		if((sz = read(fd, buf->ptr, rlen)) <= 0) {
+#ifdef O_DIRECT
+			if(sz < 0 && errno == EINVAL && (oflags & O_DIRECT)) {
+				oflags &= ~O_DIRECT;
+				if(fcntl(fd, F_SETFL, oflags) == 0) continue;
+			}
+#endif
+			err = (sz == 0) ? EIO : errno;	/* file shrunk */
+			goto quit;
+		}
+		if((size_t) sz > len) sz = len;
+		blake3_hasher_update(&hasher, buf->ptr, (size_t) sz);
+		len -= (size_t) sz;
+		pthread_mutex_lock(&mutex_split);
+		sp->job->checked += sz;
+		pthread_mutex_unlock(&mutex_split);
+	}
+	blake3_subtree_cv(&hasher, off, &sp->cvs[idx * BLAKE3_OUT_LEN]);
+quit:
+	close(fd);
+	return err;
+}
+
+void	/* called with mutex_split held */
+hash_piece_done(split_t *sp, int err) {
+	if(err != 0 && sp->err == 0) sp->err = err;
+	if(++sp->done == sp->npieces)
+		pthread_cond_broadcast(&sp->cond);
+}
+
+long	/* hash a large blake3 file as subtrees, idle workers may join via hash_help() */
+hash_split(job_t *job, unsigned long long fsize, visualizer_t vzer, void *varg) {
+	split_t sp, **pp;
+	size_t idx;
+	int err;
+	char msg[128];
+	unsigned char root[BLAKE3_OUT_LEN];
+	memset(&sp, 0, sizeof(sp));
+	sp.job = job;
+	sp.fsize = fsize;
+	sp.npieces = (size_t) ((fsize + HASHSUMR_SPLIT_SIZE - 1) / HASHSUMR_SPLIT_SIZE);
+	if((sp.cvs = (unsigned char *) malloc(sp.npieces * BLAKE3_OUT_LEN)) == NULL)
+		return jobstate(job, ERR_INIT, "hash init failed (%s)", job->md[0]->name);
+	pthread_cond_init(&sp.cond, NULL);
+	pthread_mutex_lock(&mutex_split);
+	sp.link = splits;
+	splits = &sp;
+	pthread_cond_broadcast(&cond_split);
+	while(sp.next < sp.npieces) {
+		idx = sp.next++;
+		pthread_mutex_unlock(&mutex_split);
+		err = hash_piece(&sp, idx);
+		if(vzer != NULL) vzer(job, varg);
+		pthread_mutex_lock(&mutex_split);
+		hash_piece_done(&sp, err);
+	}
+	for(pp = &splits; *pp != &sp; pp = &(*pp)->link)
+		;
+	*pp = sp.link;
+	while(sp.done < sp.npieces)
+		pthread_cond_wait(&sp.cond, &mutex_split);
+	pthread_mutex_unlock(&mutex_split);
+	pthread_cond_destroy(&sp.cond);
+	if(sp.err != 0) {
+		free(sp.cvs);
+		return jobstate(job, ERR_READ, "read failed (%d): %s", sp.err,
+			herrmsg(msg, sizeof(msg), sp.err));
+	}
+	blake3_subtree_merge(sp.cvs, sp.npieces, root);
+	free(sp.cvs);
+	job_sethash(job, 0, root, BLAKE3_OUT_LEN);
+	if(vzer != NULL) vzer(job, varg);
+	return job->code = STATE_DONE;
+}
+
+void	/* for idle workers: hash pieces of split files until *active drops to zero */
+hash_help(volatile int *active) {
+	split_t *sp;
+	size_t idx;
+	int err;
+	pthread_mutex_lock(&mutex_split);
+	while(1) {
+		for(sp = splits; sp != NULL && sp->next >= sp->npieces; sp = sp->link)
+			;
+		if(sp != NULL) {
+			idx = sp->next++;
+			pthread_mutex_unlock(&mutex_split);
+			err = hash_piece(sp, idx);
+			pthread_mutex_lock(&mutex_split);
+			hash_piece_done(sp, err);
+			continue;
+		}
+		if(*active <= 0) break;
+		pthread_cond_wait(&cond_split, &mutex_split);
+	}
+	pthread_mutex_unlock(&mutex_split);
+}
+
+void	/* wake up idle workers after *active has changed */
+hash_help_wakeup() {
+	pthread_mutex_lock(&mutex_split);
+	pthread_cond_broadcast(&cond_split);
+	pthread_mutex_unlock(&mutex_split);
+}
+
+#ifndef _WIN32
+static unsigned long long cache_seed = 0;
+static volatile int cache_mismatches = 0;
+
+static int	/* get_fileinfo() that also returns the cache key of a regular file */
+cache_fileinfo(const char *filename, unsigned long long *sz, int *type, cachekey_t *key) {
+	struct stat st;
+	if(stat(filename, &st) < 0)
+		return errno;
+	if(!S_ISREG(st.st_mode))
+		return get_fileinfo(filename, sz, type, NULL);
+	cache_key(&st, key);
+	*sz = st.st_size;
+	*type = S_IFREG;
+	return 0;
+}
+
+static int	/* is a cache hit hashed anyway? a different sample every run */
+cache_sample(const cachekey_t *key) {
+	unsigned long long x;
+	if(hashopt.verify <= 0) return 0;
+	if(hashopt.verify >= 100) return 1;
+	if(cache_seed == 0)
+		cache_seed = ((unsigned long long) time(NULL) << 20) ^ (unsigned long long) getpid();
+	x = key->ino ^ (key->dev << 40) ^ cache_seed;
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdULL;
+	x ^= x >> 33;
+	return (int) (x % 100) < hashopt.verify;
+}
+
+static int	/* the cached digests of all the algorithms of a job, 0 if found */
+cache_lookup(job_t *job, const cachekey_t *key, unsigned char (*h)[CACHE_DIGEST_SIZE], unsigned int *hlen) {
+	int i;
+	for(i = 0; i < job->nmd; i++) {
+		if(cache_get(hashopt.cache, key, job->md[i]->name, h[i], &hlen[i]) != 0)
+			return -1;
+	}
+	return 0;
+}
+
+static void	/* cache the digests of a hashed job, compare with the cached ones if h is set */
+cache_update(job_t *job, const cachekey_t *key, unsigned char (*h)[CACHE_DIGEST_SIZE], unsigned int *hlen) {
+	char names[ERRMSG_SIZE / 2] = "", msg[ERRMSG_SIZE];
+	int i;
+	for(i = 0; i < job->nmd; i++) {
+		if(h != NULL && (hlen[i] != job->hashlen[i] || memcmp(h[i], job_hash(job, i), hlen[i]) != 0)) {
+			if(names[0] != '\0') strncat(names, ",", sizeof(names) - strlen(names) - 1);
+			strncat(names, job->md[i]->name, sizeof(names) - strlen(names) - 1);
+			ATOMIC_ADD(&cache_mismatches, 1);
+		}
+		cache_put(hashopt.cache, key, job->md[i]->name, job_hash(job, i), job->hashlen[i]);
+	}
+	if(names[0] != '\0') {
+		/* a done job has no error, the warning is printed with its digests */
+		snprintf(msg, sizeof(msg), "cached %s digest did NOT match, replaced", names);
+		job->errmsg = intern(msg);
+	}
+}
+#endif
+
+int	/* # of cache hits that did not match the file with --verify-cache */
+hash_cache_mismatches() {
+#ifdef _WIN32
+	return 0;
+#else
+	return cache_mismatches;
+#endif
+}
+
+static long	/* read a small file into a slot, STATE_UNKNOWN to read (the rest of) it as usual */
+hash_gather(job_t *job, int fd, feed_t *feed) {
+	unsigned char *p, more;
+	size_t len = 0;
+	int sz = 0;
+	char msg[128];
+	if(ngathered >= MBHASH_JOBS)
+		return STATE_UNKNOWN;
+	if(gathered == NULL) {
+		gathered = (gathered_t *) calloc(MBHASH_JOBS, sizeof(gathered_t));
+		gatherbuf = (unsigned char *) malloc((size_t) MBHASH_JOBS * MBHASH_MAX);
+		if(gathered == NULL || gatherbuf == NULL) {
+			hash_release();
+			return STATE_UNKNOWN;
+		}
+	}
+	p = gatherbuf + (size_t) ngathered * MBHASH_MAX;
+	while(len < MBHASH_MAX && (sz = read(fd, p + len, MBHASH_MAX - len)) > 0) {
+		len += sz;
+		/* short of the request and at the size of stat: no read of 0 */
+		if(len < MBHASH_MAX && len == job->filesz) break;
+	}
+	if(sz >= 0 && len == MBHASH_MAX)
+		sz = read(fd, &more, 1);
+	if(sz < 0) {
+		return jobstate(job, ERR_READ, "read failed (%d): %s", errno,
+			herrmsg(msg, sizeof(msg), errno));
+	}
+	if(len == MBHASH_MAX && sz > 0) {
+		/* grown since stat, too large to wait for hash_flush() */
+		if(hash_update(p, len, feed) != 0 || hash_update(&more, 1, feed) != 0)
+			return job->code;
+		return STATE_UNKNOWN;
+	}
+	gathered[ngathered].job = job;
+	gathered[ngathered].len = len;
+	gathered[ngathered].timed = 0;
+	ngathered++;
+	job->checked = len;
+	return job->code = STATE_PENDING;
+}
+
+int	/* hash the files gathered by this thread, returns how many jobs it finished */
+hash_flush() {
+	const unsigned char *msg[MBHASH_JOBS];
+	size_t len[MBHASH_JOBS];
+	unsigned char h[MBHASH_JOBS][32];
+	unsigned long long t = hashopt.stats != NULL ? stats_now() : 0;
+	int i, n = ngathered;
+	if(n == 0)
+		return 0;
+	for(i = 0; i < n; i++) {
+		msg[i] = gatherbuf + (size_t) i * MBHASH_MAX;
+		len[i] = gathered[i].len;
+	}
+	if(n == 1) {
+		/* a single file is faster in one stream */
+		job_t *job = gathered[0].job;
+		ctx_t *ctx;
+		unsigned int hlen = sizeof(h[0]);
+		if((ctx = ctx_get(job->md[0])) == NULL
+		|| job->md[0]->finit(ctx, job->md[0]->arginit) != 1
+		|| job->md[0]->fupdate(ctx, (void *) msg[0], len[0]) != 1
+		|| job->md[0]->ffinal(ctx, h[0], &hlen) != 1) {
+			jobstate(job, ERR_FINAL, "hash final failed (%s)", job->md[0]->name);
+		}
+		if(ctx != NULL) ctx_put(job->md[0], ctx);
+	} else {
+		mbhash_sha256(msg, len, n, h);
+	}
+	if(hashopt.stats != NULL)
+		t = (stats_now() - t) / n;	/* each file gets its share */
+	for(i = 0; i < n; i++) {
+		gathered_t *g = &gathered[i];
+		job_t *job = g->job;
+		if(job->code != STATE_PENDING) {
+			/* failed above */
+		} else if(job_sethash(job, 0, h[i], 32) != 0) {
+			jobstate(job, ERR_FINAL, "hash final failed (%s)", job->md[0]->name);
+		} else {
+			job->code = STATE_DONE;
+#ifndef _WIN32
+			if(hashopt.cache != NULL)
+				cache_update(job, &g->key, g->cached ? g->chash : NULL, g->chlen);
+#endif
+		}
+		if(g->timed) {
+			g->fs.hash += t;
+			g->fs.bytes = g->len;
+			stats_file(hashopt.stats, job, &g->fs);
+		}
+	}
+	ngathered = 0;
+	return n;
+}
+
+static void *	/* with fs, fs->open is the time the file was opened, see hash1() */
+hash_file(job_t *job, visualizer_t vzer, void *varg, filestat_t *fs) {
+	int fd = -1, sz, i, oflags = O_RDONLY;
+	char msg[128];
+	buf_t *buf;
+	ctx_t *ctx[HASHSUMR_MAX_ALGS] = { NULL };
+	feed_t feed = { job, ctx, vzer, varg, fs };
+	unsigned long long t;
 	long state = STATE_UNKNOWN;
 	int err, ftype;
 	unsigned long long fsize;
+	int stdinput = (job->filename[0] == '-' && job->filename[1] == '\0');
+	int stream = stdinput;	/* stdin or a fifo, read by a thread of its own */
+#ifndef _WIN32
+	cachekey_t key = { 0 };
+	int cached = 0;	/* hit picked by --verify-cache */
+	unsigned char chash[HASHSUMR_MAX_ALGS][CACHE_DIGEST_SIZE];
+	unsigned int chlen[HASHSUMR_MAX_ALGS];
+#endif
 
-	if(job->md == NULL) {
+	if(job->nmd <= 0 || job->md[0] == NULL) {
 		return (void *) jobstate(job, ERR_ALG, "unsupported algorithm (%s)", job->mdname);
 	}
-	ctx = job->md->fnew();
 	job->checked = 0;
 
 #ifdef _WIN32
-	if((err = get_fileinfo(job->wfilename, &fsize, &ftype)) != 0) {
+	if(stdinput) {
+		fsize = HASHSUMR_SIZE_UNKNOWN;
+		ftype = S_IFREG;
+	} else if((err = get_fileinfo(job->wfilename, &fsize, &ftype, NULL)) != 0) {
 #else
-	if((err = get_fileinfo(job->filename, &fsize, &ftype)) != 0) {
+	if(stdinput) {
+		fsize = HASHSUMR_SIZE_UNKNOWN;
+		ftype = S_IFIFO;
+	} else if((err = hashopt.cache != NULL ? cache_fileinfo(job->filename, &fsize, &ftype, &key)
+			: get_fileinfo(job->filename, &fsize, &ftype, NULL)) != 0) {
 #endif
 		if(err == ENOENT)
 			return (void *) jobstate(job, ERR_MISSING, "no such file or directory");
 		return (void *) jobstate(job, ERR_STAT, "stat failed (%d): %s", err,
-			herrmsg(buf, sizeof(buf), err));
+			herrmsg(msg, sizeof(msg), err));
 	}
 
-	if(ftype != S_IFREG) {
+#ifndef _WIN32
+	if(ftype == S_IFIFO) {
+		stream = 1;
+		fsize = HASHSUMR_SIZE_UNKNOWN;
+	}
+#endif
+	if(ftype != S_IFREG && stream == 0) {
 		if(ftype == S_IFDIR) {
 			return (void *) jobstate(job, ERR_NOTREG, "is a directory");
 		}
 #ifndef _WIN32
-		if(ftype == S_IFIFO) {
-			return (void *) jobstate(job, ERR_NOTREG, "is a fifo");
-		}
 		if(ftype == S_IFSOCK) {
 			return (void *) jobstate(job, ERR_NOTREG, "is a socket");
 		}
@@ -204,40 +763,207 @@ hash1(job_t *job, visualizer_t vzer, void *varg) {
 
 	job->filesz = fsize;
 
-	if(job->md->finit(ctx, job->md->arginit) != 1) {
-		return (void *) jobstate(job, ERR_INIT, "hash init failed");
+#ifndef _WIN32
+	/* unchanged since cached, no need to read it */
+	if(hashopt.cache != NULL && stream == 0 && cache_lookup(job, &key, chash, chlen) == 0) {
+		if(cache_sample(&key) == 0) {
+			for(i = 0; i < job->nmd; i++) {
+				if(job_sethash(job, i, chash[i], chlen[i]) != 0)
+					return (void *) jobstate(job, ERR_FINAL, "hash final failed (%s)", job->md[i]->name);
+			}
+			job->checked = fsize;
+			if(vzer) vzer(job, varg);
+			state = job->code = STATE_DONE;
+			return (void *) state;
+		}
+		cached = 1;
+	}
+#endif
+
+	if((buf = bufpool_get()) == NULL) {
+		state = jobstate(job, ERR_INIT, "allocate buffer failed");
+		goto cleanup;
+	}
+
+	if(hashopt.split && stream == 0 && job->serial == 0 && job->nmd == 1 && job->md[0]->fnew == blake3_new
+	&& fsize > 2 * HASHSUMR_SPLIT_SIZE) {
+		if(fs != NULL) fs->open = stats_now();
+		state = hash_split(job, fsize, vzer, varg);
+		if(fs != NULL) {
+			fs->hash = stats_now() - fs->open;
+			fs->bytes = job->checked;
+		}
+		goto cleanup;
+	}
+
+	for(i = 0; i < job->nmd; i++) {
+		if((ctx[i] = ctx_get(job->md[i])) == NULL
+		|| job->md[i]->finit(ctx[i], job->md[i]->arginit) != 1) {
+			state = jobstate(job, ERR_INIT, "hash init failed (%s)", job->md[i]->name);
+			goto cleanup;
+		}
 	}
 
 #ifdef _WIN32
-	if(_wsopen_s(&fd, job->wfilename, O_RDONLY|_O_BINARY, _SH_DENYWR, _S_IREAD) != 0) {
+	if(stdinput) {
+		fd = STDIN_FILENO;
+		_setmode(fd, _O_BINARY);
+	} else if(_wsopen_s(&fd, job->wfilename, O_RDONLY|_O_BINARY, _SH_DENYWR, _S_IREAD) != 0) {
 #else
-	if((fd = open(job->filename, O_RDONLY)) < 0) {
+#ifdef O_DIRECT
+	if(hashopt.direct && stream == 0) oflags |= O_DIRECT;
 #endif
-		return (void *) jobstate(job, ERR_OPEN, "open failed (%d): %s", errno,
-			herrmsg(buf, sizeof(buf), errno));
+	if(stdinput) {
+		fd = STDIN_FILENO;
+	} else if((fd = open(job->filename, oflags)) < 0 && oflags != O_RDONLY && errno == EINVAL) {
+		/* the filesystem does not support direct i/o */
+		oflags = O_RDONLY;
+		fd = open(job->filename, oflags);
 	}
+	if(fd < 0) {
+#endif
+		state = jobstate(job, ERR_OPEN, "open failed (%d): %s", errno,
+			herrmsg(msg, sizeof(msg), errno));
+		goto cleanup;
+	}
+#ifdef F_NOCACHE
+	if(hashopt.direct && stream == 0) fcntl(fd, F_NOCACHE, 1);
+#endif
+	if(fs != NULL) fs->open = stats_now();
 
-	while((sz = read(fd, buf, sizeof(buf))) > 0) {
-		if(job->md->fupdate(ctx, buf, sz) != 1) {
-			state = jobstate(job, ERR_UPDATE, "hash update failed");
+	if(hashopt.multibuf && stream == 0 && hashopt.direct == 0 && job->nmd == 1 && fsize <= MBHASH_MAX
+	&& strcmp(job->md[0]->name, "SHA256") == 0) {
+		if((state = hash_gather(job, fd, &feed)) == STATE_PENDING) {
+#ifndef _WIN32
+			gathered_t *g = &gathered[ngathered - 1];
+			if(hashopt.cache != NULL) {
+				g->key = key;
+				g->cached = cached;
+				memcpy(g->chash, chash, sizeof(chash));
+				memcpy(g->chlen, chlen, sizeof(chlen));
+			}
+#endif
+			goto cleanup;
+		} else if(state != STATE_UNKNOWN) {
 			goto cleanup;
+		} else if(job->checked > 0) {
+			goto readloop;	/* grown, the rest is read below */
 		}
-		job->checked += sz;
-		if(vzer != NULL) vzer(job, varg);
 	}
 
-	if(job->md->ffinal(ctx, job->hash, &job->hashlen) != 1) {
-		state = jobstate(job, ERR_FINAL, "hash final failed");
+	if(stream || (hashopt.engine == IOENGINE_PIPELINE && fsize >= HASHSUMR_PIPELINE_MIN)) {
+		/* a reader thread waits for the writer or the disk while we hash */
+		if((err = stream_readfile(fd, hashopt.bufsize, hash_update, &feed)) == -2) {
+			state = job->code;
+			goto cleanup;
+		} else if(err > 0) {
+			state = jobstate(job, ERR_READ, "read failed (%d): %s", err,
+				herrmsg(msg, sizeof(msg), err));
+			goto cleanup;
+		}
+		if(stream) job->filesz = job->checked;
+		goto final;
+	}
+
+#ifndef _WIN32
+	if(hashopt.engine == IOENGINE_MMAP && fsize >= HASHSUMR_MMAP_MIN) {
+		if((state = hash_mmap(job, fd, &feed)) != STATE_UNKNOWN)
+			goto cleanup;
+	} else if(hashopt.engine == IOENGINE_URING) {
+		unsigned long long done;
+		if((err = uring_readfile(fd, fsize, hashopt.iodepth, hashopt.bufsize, hashopt.hugepages,
+				hash_update, &feed, &done)) == -2) {
+			state = job->code;
+			goto cleanup;
+		} else if(err > 0) {
+			state = jobstate(job, ERR_READ, "read failed (%d): %s", err,
+				herrmsg(msg, sizeof(msg), err));
+			goto cleanup;
+		}
+	}
+	/* continue with read(2) from where the engine stopped */
+	if(job->checked > 0 && lseek(fd, (off_t) job->checked, SEEK_SET) < 0) {
+		state = jobstate(job, ERR_READ, "seek failed (%d): %s", errno,
+			herrmsg(msg, sizeof(msg), errno));
+		goto cleanup;
+	}
+#endif
+
+readloop:
+	/* one read pass feeds all the algorithms */
+	while(1) {
+		if((sz = read(fd, buf->ptr, buf->size)) > 0) {
+			if(hash_update(buf->ptr, sz, &feed) != 0) {
+				state = job->code;
+				goto cleanup;
+			}
+			/* short of the request and at the size of stat, a small
+			 * file is done in one read, without the read of 0 */
+			if((size_t) sz < buf->size && job->checked == fsize)
+				break;
+			continue;
+		}
+#ifdef O_DIRECT
+		if(sz < 0 && errno == EINVAL && (oflags & O_DIRECT)) {
+			/* unaligned tail (or offset), finish it through the page cache */
+			oflags &= ~O_DIRECT;
+			if(fcntl(fd, F_SETFL, oflags) == 0) continue;
+		}
+#endif
+		break;
+	}
+	if(sz < 0) {
+		state = jobstate(job, ERR_READ, "read failed (%d): %s", errno,
+			herrmsg(msg, sizeof(msg), errno));
 		goto cleanup;
 	}
 
-	digest(job->hash, job->hashlen, job->digest, HASHSUMR_MAX_DIGEST_SIZE);
+final:
+	t = fs != NULL ? stats_now() : 0;
+	for(i = 0; i < job->nmd; i++) {
+		unsigned char h[EVP_MAX_MD_SIZE];
+		unsigned int hlen = sizeof(h);
+		if(job->md[i]->ffinal(ctx[i], h, &hlen) != 1
+		|| job_sethash(job, i, h, hlen) != 0) {
+			state = jobstate(job, ERR_FINAL, "hash final failed (%s)", job->md[i]->name);
+			goto cleanup;
+		}
+	}
+	if(fs != NULL) fs->hash += stats_now() - t;
 	state = job->code = STATE_DONE;
 
 cleanup:
-	if(fd > -1) close(fd);
-	job->md->ffree(ctx);
+	if(fd > -1 && stdinput == 0) close(fd);
+	for(i = 0; i < job->nmd; i++) {
+		if(ctx[i] != NULL) ctx_put(job->md[i], ctx[i]);
+	}
+#ifndef _WIN32
+	if(state == STATE_DONE && hashopt.cache != NULL)
+		cache_update(job, &key, cached ? chash : NULL, chlen);
+#endif
 
 	return (void *) state;
 }
 
+void *	/* hash a file, its timings go to hashopt.stats if set */
+hash1(job_t *job, visualizer_t vzer, void *varg) {
+	filestat_t fs = { 0 };
+	unsigned long long t0, t;
+	void *state;
+	if(hashopt.stats == NULL)
+		return hash_file(job, vzer, varg, NULL);
+	t0 = stats_now();
+	state = hash_file(job, vzer, varg, &fs);
+	t = stats_now();
+	if(fs.open == 0) fs.open = t;	/* failed or cached before it was opened */
+	fs.read = t - fs.open > fs.hash ? t - fs.open - fs.hash : 0;
+	fs.open -= t0;
+	if(job->code == STATE_PENDING) {
+		/* hash_flush() adds the hash time */
+		gathered[ngathered - 1].fs = fs;
+		gathered[ngathered - 1].timed = 1;
+		return state;
+	}
+	stats_file(hashopt.stats, job, &fs);
+	return state;
+}
\ No newline at end of file
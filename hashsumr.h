@@ -26,6 +26,24 @@ extern "C" {
 #define _T(x)	x
 #endif
 
+#ifdef _WIN32
+#define	THREAD_LOCAL	__declspec(thread)
+#else
+#define	THREAD_LOCAL	__thread
+#endif
+
+#ifdef _WIN32
+#define	ATOMIC_ADD(p, v)	InterlockedExchangeAdd((volatile LONG *) (p), (v))
+#define	ATOMIC_ADD64(p, v)	InterlockedExchangeAdd64((volatile LONGLONG *) (p), (v))
+#define	ATOMIC_LOAD(p)		(*(p))	/* volatile accesses are acquire/release in msvc */
+#define	ATOMIC_STORE(p, v)	(*(p) = (v))
+#else
+#define	ATOMIC_ADD(p, v)	__atomic_fetch_add((p), (v), __ATOMIC_RELAXED)
+#define	ATOMIC_ADD64(p, v)	__atomic_fetch_add((p), (v), __ATOMIC_RELAXED)
+#define	ATOMIC_LOAD(p)		__atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define	ATOMIC_STORE(p, v)	__atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#endif
+
 #ifndef EVP_MAX_MD_SIZE
 #define EVP_MAX_MD_SIZE	128
 #endif
@@ -49,6 +67,7 @@ typedef int    (*ctx_init_t)(ctx_t *ctx, void *arg);
 typedef void   (*ctx_free_t)(ctx_t *ctx);
 typedef int    (*ctx_update_t)(ctx_t *ctx, void *buf, size_t bufsz);
 typedef int    (*ctx_final_t)(ctx_t *ctx, unsigned char *digest, unsigned int *dlen);
+typedef int    (*ctx_reset_t)(ctx_t *ctx);
 
 typedef struct md_s {
 	const char *name;
@@ -58,29 +77,72 @@ typedef struct md_s {
 	ctx_free_t   ffree;
 	ctx_update_t fupdate;
 	ctx_final_t  ffinal;
+	ctx_reset_t  freset;	/* after ffinal or a failure, before the context is reused */
 }	md_t;
 
 #define	EVP_MAX_DIGEST_SIZE	((EVP_MAX_MD_SIZE<<1) + 2)
-#define	ERRMSG_SIZE	256
+#define	ERRMSG_SIZE	256	/* longest error message */
+#define	HASHSUMR_MAX_ALGS	4	/* max # of algorithms computed in one pass */
 
+#define	HASHSUMR_JOB_HASH	64	/* digest bytes kept in a job, more are allocated */
+
+/* one file to hash. on 64-bit posix a job takes 136 bytes, plus its
+ * file name (and expected digest in check mode) in the job store's
+ * string arena. hex digests are only formatted when printed */
 typedef struct job_s {
-	pthread_mutex_t mutex;
-	const char *mdname;
-	md_t *md;
-	char *filename;
+	char *filename;	/* utf-8 */
+#ifdef _WIN32
 	wchar_t *wfilename;
+#endif
+	md_t **md;	/* nmd algorithms, shared by jobs */
+	const char *mdname;	/* as named in a check file, for unsupported algorithms */
+	const unsigned char *dcheck;	/* expected digest, for opt_check */
+	const char *errmsg;	/* interned, see jobstate(). a warning if the job is done */
 	unsigned long long checked;
 	unsigned long long filesz;
-	long code;	/* job state code */
-	unsigned int hashlen;
-	unsigned char hash[EVP_MAX_MD_SIZE];
-	char digest[EVP_MAX_DIGEST_SIZE];
-	char dcheck[EVP_MAX_DIGEST_SIZE];	/* for opt_check */
-	char errmsg[ERRMSG_SIZE];
+	unsigned char *xhash;	/* digests that do not fit hash[] */
+	unsigned char hash[HASHSUMR_JOB_HASH];	/* digests back to back */
+	unsigned char hashlen[HASHSUMR_MAX_ALGS];
+	unsigned char code;	/* job state code */
+	unsigned char nmd;	/* # of algorithms, check mode always uses one */
+	unsigned char serial;	/* never split, e.g., on a rotational disk */
+	unsigned char dchecklen;
 }	job_t;
 
 typedef void   (*visualizer_t)(job_t *job, void *arg);
 
+/* i/o options for hash1(), set once before running jobs */
+
+#define	HASHSUMR_MMAP_MIN	(1ULL<<20)	/* smaller files are always read(2) */
+#define	HASHSUMR_MMAP_WINDOW	(64ULL<<20)	/* bytes mapped at a time */
+#define	HASHSUMR_PIPELINE_MIN	(1ULL<<20)	/* smaller files are not worth a reader thread */
+
+enum {	// i/o engines
+	IOENGINE_READ = 0,	// read(2) into a buffer
+	IOENGINE_MMAP,		// map regular files, posix only
+	IOENGINE_URING,		// io_uring with several reads in flight, linux only
+	IOENGINE_PIPELINE,	// a reader thread per file reads ahead while the worker hashes
+};
+
+#define	HASHSUMR_BUFSIZE	(128<<10)	/* default read size */
+#define	HASHSUMR_SPLIT_SIZE	(16ULL<<20)	/* blake3 subtree per task, a power of 2 of chunks */
+#define	HASHSUMR_SIZE_UNKNOWN	(~0ULL)	/* job->filesz of stdin or a fifo until it is read */
+
+typedef struct hashopt_s {
+	int engine;	/* IOENGINE_* */
+	int iodepth;	/* reads in flight per worker for IOENGINE_URING */
+	size_t bufsize;	/* bytes per read */
+	int hugepages;	/* back the buffers with huge pages if possible */
+	int direct;	/* bypass the page cache (O_DIRECT) */
+	int split;	/* let idle workers help with large blake3 files */
+	struct cache_s *cache;	/* digests of unchanged files, posix only */
+	int verify;	/* % of cache hits that are hashed anyway */
+	struct stats_s *stats;	/* per-file timings for --stats */
+	int multibuf;	/* gather small sha-256 files for hash_flush(), workers only */
+}	hashopt_t;
+
+extern hashopt_t hashopt;
+
 /* state codes */
 
 enum {           // job state codes
@@ -94,18 +156,31 @@ enum {           // job state codes
 	ERR_INIT,    // hash init failed
 	ERR_UPDATE,  // hash update failed
 	ERR_FINAL,   // hash final failaed
+	ERR_READ,    // read(2) failed
+	STATE_PENDING, // read, hashed by the next hash_flush() of the thread
 };
 
 char * herrmsg(char *buf, size_t sz, int errnum);
 
 md_t * get_hashes();
 md_t * lookup_hash(const char *name);
+md_t ** md_ref(md_t *md);
+char * digest(unsigned char *hash, unsigned int hlen, char *digest, unsigned int dlen);
+unsigned char * job_hash(job_t *job, int idx);
+int    job_sethash(job_t *job, int idx, const unsigned char *hash, unsigned int hlen);
+int    get_fileinfo(const TCHAR *filename, unsigned long long *sz, int *type, unsigned long long *dev);
 void * hash1(job_t *job, visualizer_t vzer, void *varg);
+void   hash_help(volatile int *active);
+void   hash_help_wakeup();
+void   hash_release();
+int    hash_flush();
+int    hash_cache_mismatches();
 
 #ifdef _WIN32
 #define close	_close
 #define read	_read
 #define strdup	_strdup
+#define	STDIN_FILENO	0
 #endif
 
 #ifdef __cplusplus
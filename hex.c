@@ -0,0 +1,56 @@
+#include <string.h>
+#include "hex.h"
+
+/* digests are at most 64 bytes, too short for vector code to pay off;
+ * one table load per byte in each direction is already branch-free */
+
+static const char hexpairs[] =
+	"000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f"
+	"202122232425262728292a2b2c2d2e2f303132333435363738393a3b3c3d3e3f"
+	"404142434445464748494a4b4c4d4e4f505152535455565758595a5b5c5d5e5f"
+	"606162636465666768696a6b6c6d6e6f707172737475767778797a7b7c7d7e7f"
+	"808182838485868788898a8b8c8d8e8f909192939495969798999a9b9c9d9e9f"
+	"a0a1a2a3a4a5a6a7a8a9aaabacadaeafb0b1b2b3b4b5b6b7b8b9babbbcbdbebf"
+	"c0c1c2c3c4c5c6c7c8c9cacbcccdcecfd0d1d2d3d4d5d6d7d8d9dadbdcdddedf"
+	"e0e1e2e3e4e5e6e7e8e9eaebecedeeeff0f1f2f3f4f5f6f7f8f9fafbfcfdfeff";
+
+#define	X	0x10	/* not a hex digit */
+static const unsigned char hexval[256] = {
+	X,X,X,X,X,X,X,X,X,X,X,X,X,X,X,X, X,X,X,X,X,X,X,X,X,X,X,X,X,X,X,X,
+	X,X,X,X,X,X,X,X,X,X,X,X,X,X,X,X, 0,1,2,3,4,5,6,7,8,9,X,X,X,X,X,X,
+	X,10,11,12,13,14,15,X,X,X,X,X,X,X,X,X, X,X,X,X,X,X,X,X,X,X,X,X,X,X,X,X,
+	X,10,11,12,13,14,15,X,X,X,X,X,X,X,X,X, X,X,X,X,X,X,X,X,X,X,X,X,X,X,X,X,
+	X,X,X,X,X,X,X,X,X,X,X,X,X,X,X,X, X,X,X,X,X,X,X,X,X,X,X,X,X,X,X,X,
+	X,X,X,X,X,X,X,X,X,X,X,X,X,X,X,X, X,X,X,X,X,X,X,X,X,X,X,X,X,X,X,X,
+	X,X,X,X,X,X,X,X,X,X,X,X,X,X,X,X, X,X,X,X,X,X,X,X,X,X,X,X,X,X,X,X,
+	X,X,X,X,X,X,X,X,X,X,X,X,X,X,X,X, X,X,X,X,X,X,X,X,X,X,X,X,X,X,X,X,
+};
+#undef	X
+
+int	/* lowercase hex of len bytes and a nul, -1 if hexsz is too small */
+hex_encode(const unsigned char *bin, unsigned int len, char *hex, unsigned int hexsz) {
+	unsigned int i;
+	if(hexsz < 2 * len + 1)
+		return -1;
+	for(i = 0; i < len; i++)
+		memcpy(hex + 2 * i, hexpairs + 2 * bin[i], 2);
+	hex[2 * len] = '\0';
+	return 2 * len;
+}
+
+int	/* # of bytes of a nul-terminated hex string of either case,
+	 * -1 if it is empty, has an odd length, a non-hex char, or does not fit */
+hex_decode(const char *hex, unsigned char *bin, unsigned int binsz) {
+	const unsigned char *p = (const unsigned char *) hex;
+	unsigned int n = 0;
+	unsigned char hi, lo;
+	while(*p) {
+		hi = hexval[p[0]];
+		lo = hexval[p[1]];	/* the nul maps to not-a-digit */
+		if((hi | lo) & 0x10 || n >= binsz)
+			return -1;
+		bin[n++] = (unsigned char) (hi << 4 | lo);
+		p += 2;
+	}
+	return n > 0 ? (int) n : -1;
+}
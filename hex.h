@@ -0,0 +1,9 @@
+#ifndef __HEX_H__
+#define __HEX_H__
+
+/* table-driven hex codec for digests */
+
+int  hex_encode(const unsigned char *bin, unsigned int len, char *hex, unsigned int hexsz);
+int  hex_decode(const char *hex, unsigned char *bin, unsigned int binsz);
+
+#endif	/* __HEX_H__ */
@@ -0,0 +1,147 @@
+#include <stdlib.h>
+#include <string.h>
+#include "hashsumr.h"
+#include "jobstore.h"
+
+static void
+chunk_free(jobchunk_t *chunk) {
+	arena_t *a, *next;
+	int i;
+	for(i = 0; i < JOBSTORE_CHUNK; i++) {
+		if(chunk->jobs[i].xhash != NULL)
+			free(chunk->jobs[i].xhash);
+	}
+	for(a = chunk->arena; a != NULL; a = next) {
+		next = a->next;
+		free(a);
+	}
+	free(chunk);
+}
+
+int
+jobstore_init(jobstore_t *s) {
+	memset(s, 0, sizeof(jobstore_t));
+	pthread_mutex_init(&s->mutex, NULL);
+	pthread_cond_init(&s->cond, NULL);
+	/* pages of the chunk table are only touched as it fills */
+	if((s->chunk = (jobchunk_t **) calloc(JOBSTORE_MAX_CHUNKS, sizeof(jobchunk_t *))) == NULL)
+		return -1;
+	return 0;
+}
+
+int	/* keep at most nchunks chunks in use, every job added must be released */
+jobstore_bound(jobstore_t *s, int nchunks) {
+	if(nchunks < 2) nchunks = 2;	/* the producer may be filling one chunk */
+	if((s->released = (volatile int *) calloc(JOBSTORE_MAX_CHUNKS, sizeof(int))) == NULL)
+		return -1;
+	s->live = (s->count + JOBSTORE_CHUNK - 1) >> JOBSTORE_SHIFT;
+	s->bound = nchunks;
+	return 0;
+}
+
+job_t *	/* append a zeroed job, NULL if out of memory. not thread-safe.
+	 * waits for released jobs if the store is bounded */
+jobstore_add(jobstore_t *s) {
+	int c = s->count >> JOBSTORE_SHIFT;
+	if(c >= JOBSTORE_MAX_CHUNKS) {
+		errno = ENOSPC;
+		return NULL;
+	}
+	if(s->chunk[c] == NULL) {
+		if(s->bound > 0) {
+			pthread_mutex_lock(&s->mutex);
+			while(s->live >= s->bound)
+				pthread_cond_wait(&s->cond, &s->mutex);
+			s->live++;
+			pthread_mutex_unlock(&s->mutex);
+		}
+		if((s->chunk[c] = (jobchunk_t *) calloc(1, sizeof(jobchunk_t))) == NULL)
+			return NULL;
+	}
+	s->count++;
+	return JOBSTORE_AT(s, s->count - 1);
+}
+
+void	/* drop the last added job, before it is published */
+jobstore_pop(jobstore_t *s) {
+	if(s->count > 0) {
+		s->count--;
+		memset(JOBSTORE_AT(s, s->count), 0, sizeof(job_t));
+	}
+}
+
+void *	/* memory for the last added job, lives as long as its chunk */
+jobstore_alloc(jobstore_t *s, size_t size) {
+	jobchunk_t *chunk;
+	arena_t *a;
+	void *p;
+	if(s->count <= 0)
+		return NULL;
+	chunk = s->chunk[(s->count - 1) >> JOBSTORE_SHIFT];
+	size = (size + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+	if((a = chunk->arena) == NULL || a->size - a->used < size) {
+		size_t asz = size > JOBSTORE_ARENA ? size : JOBSTORE_ARENA;
+		if((a = (arena_t *) malloc(sizeof(arena_t) + asz)) == NULL)
+			return NULL;
+		a->used = 0;
+		a->size = asz;
+		a->next = chunk->arena;
+		chunk->arena = a;
+	}
+	p = (char *) (a + 1) + a->used;
+	a->used += size;
+	return p;
+}
+
+char *
+jobstore_strdup(jobstore_t *s, const char *str) {
+	size_t len = strlen(str) + 1;
+	char *p;
+	if((p = (char *) jobstore_alloc(s, len)) != NULL)
+		memcpy(p, str, len);
+	return p;
+}
+
+#ifdef _WIN32
+wchar_t *
+jobstore_wcsdup(jobstore_t *s, const wchar_t *str) {
+	size_t len = (wcslen(str) + 1) * sizeof(wchar_t);
+	wchar_t *p;
+	if((p = (wchar_t *) jobstore_alloc(s, len)) != NULL)
+		memcpy(p, str, len);
+	return p;
+}
+#endif
+
+void	/* a bounded store's job is done with, its chunk goes when all are */
+jobstore_release(jobstore_t *s, int idx) {
+	int c = idx >> JOBSTORE_SHIFT;
+	if(s->bound == 0)
+		return;
+	if(ATOMIC_ADD(&s->released[c], 1) + 1 < JOBSTORE_CHUNK)
+		return;
+	chunk_free(s->chunk[c]);
+	s->chunk[c] = NULL;
+	pthread_mutex_lock(&s->mutex);
+	s->live--;
+	pthread_cond_signal(&s->cond);
+	pthread_mutex_unlock(&s->mutex);
+}
+
+void
+jobstore_free(jobstore_t *s) {
+	int c;
+	if(s->chunk == NULL)
+		return;
+	for(c = 0; c <= (s->count >> JOBSTORE_SHIFT) && c < JOBSTORE_MAX_CHUNKS; c++) {
+		if(s->chunk[c] != NULL)
+			chunk_free(s->chunk[c]);
+	}
+	free(s->chunk);
+	s->chunk = NULL;
+	if(s->released != NULL) {
+		free((void *) s->released);
+		s->released = NULL;
+	}
+	s->count = 0;
+}
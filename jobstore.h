@@ -0,0 +1,55 @@
+#ifndef __JOBSTORE_H__
+#define __JOBSTORE_H__
+
+/* growable job storage: jobs live in fixed-size chunks and never move,
+ * so workers can hold a job while the producer keeps appending.
+ * a bounded store frees each chunk once all its jobs are released,
+ * and the producer waits while too many chunks are in use.
+ * strings of a job (file names, expected digests) are bump-allocated
+ * from an arena owned by the job's chunk and go away with it */
+
+#include "hashsumr.h"
+
+#define	JOBSTORE_SHIFT	12	/* 4096 jobs per chunk */
+#define	JOBSTORE_CHUNK	(1<<JOBSTORE_SHIFT)
+#define	JOBSTORE_MAX_CHUNKS	(1<<17)	/* up to 512M jobs */
+#define	JOBSTORE_BOUND	4	/* chunks in use by a bounded store, at least 2 */
+#define	JOBSTORE_ARENA	(64*1024)	/* arena block size */
+
+typedef struct arena_s {
+	struct arena_s *next;
+	size_t used, size;
+	/* data follows */
+}	arena_t;
+
+typedef struct jobchunk_s {
+	job_t jobs[JOBSTORE_CHUNK];
+	arena_t *arena;	/* most recent block first */
+}	jobchunk_t;
+
+typedef struct jobstore_s {
+	jobchunk_t **chunk;	/* JOBSTORE_MAX_CHUNKS slots, allocated on demand */
+	int count;	/* # of jobs added */
+	/* bounded stores only */
+	int bound;	/* max chunks in use, 0 for unbounded */
+	int live;	/* chunks in use */
+	volatile int *released;	/* # of released jobs per chunk */
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+}	jobstore_t;
+
+#define	JOBSTORE_AT(s, i)	(&(s)->chunk[(i)>>JOBSTORE_SHIFT]->jobs[(i)&(JOBSTORE_CHUNK-1)])
+
+int     jobstore_init(jobstore_t *s);
+job_t * jobstore_add(jobstore_t *s);
+void    jobstore_pop(jobstore_t *s);
+void *  jobstore_alloc(jobstore_t *s, size_t size);
+char *  jobstore_strdup(jobstore_t *s, const char *str);
+#ifdef _WIN32
+wchar_t * jobstore_wcsdup(jobstore_t *s, const wchar_t *str);
+#endif
+int     jobstore_bound(jobstore_t *s, int nchunks);
+void    jobstore_release(jobstore_t *s, int idx);
+void    jobstore_free(jobstore_t *s);
+
+#endif	/* __JOBSTORE_H__ */
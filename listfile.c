@@ -0,0 +1,165 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <windows.h>
+#include <io.h>
+#include <share.h>
+#define	read	_read
+#define	close	_close
+#else
+#include <unistd.h>
+#endif
+#include "hashsumr.h"
+#include "listfile.h"
+
+#define PREFIX	"hashsumr: "
+
+typedef struct listfile_s {
+	int fd;
+	int delim;
+	writer_t *werr;	/* errors, in order with those of the workers */
+	walk_emit_t emit;
+	walk_done_t done;
+	void *arg;
+	TCHAR *paths[WALK_BATCH];
+	int n;
+}	listfile_t;
+
+static volatile int errors = 0;
+
+static void
+listfile_flush(listfile_t *lf) {
+	if(lf->n == 0) return;
+	lf->emit(lf->paths, lf->n, lf->arg);
+	lf->n = 0;
+}
+
+static void	/* one name, without its delimiter */
+listfile_name(listfile_t *lf, char *name, size_t len) {
+	TCHAR *path;
+	if(lf->delim == '\n' && len > 0 && name[len-1] == '\r')
+		name[--len] = '\0';
+	if(len == 0)
+		return;
+#ifdef _WIN32
+	{
+		int wlen = MultiByteToWideChar(CP_UTF8, 0, name, (int) len, NULL, 0);
+		if(wlen <= 0 || (path = (TCHAR *) malloc(sizeof(TCHAR) * (wlen + 1))) == NULL) {
+			writer_printf(lf->werr, PREFIX "%s: invalid file name\n", name);
+			ATOMIC_ADD(&errors, 1);
+			return;
+		}
+		MultiByteToWideChar(CP_UTF8, 0, name, (int) len, path, wlen);
+		path[wlen] = 0;
+	}
+#else
+	if((path = strdup(name)) == NULL) {
+		fprintf(stderr, PREFIX "files-from: out of memory\n");
+		exit(-1);
+	}
+#endif
+	lf->paths[lf->n++] = path;
+	if(lf->n == WALK_BATCH)
+		listfile_flush(lf);
+}
+
+static void *
+listfile_reader(void *arg) {
+	listfile_t *lf = (listfile_t *) arg;
+	size_t size = LISTFILE_BUFSIZE, leftover = 0, start, i;
+	char *buf, *p, msg[128];
+	long n;
+	if((buf = (char *) malloc(size)) == NULL) {
+		fprintf(stderr, PREFIX "files-from: out of memory\n");
+		exit(-1);
+	}
+	while(1) {
+		if(leftover == size - 1) {
+			/* a name longer than the buffer */
+			if((p = (char *) realloc(buf, size * 2)) == NULL) {
+				fprintf(stderr, PREFIX "files-from: out of memory\n");
+				exit(-1);
+			}
+			buf = p;
+			size *= 2;
+		}
+		/* read(2) returns what a pipe has, names are handed out without waiting for more */
+		if((n = read(lf->fd, buf + leftover, (unsigned int) (size - leftover - 1))) <= 0)
+			break;
+		n += (long) leftover;
+		for(i = start = 0; i < (size_t) n; i++) {
+			if(buf[i] != lf->delim) continue;
+			buf[i] = '\0';
+			listfile_name(lf, buf + start, i - start);
+			start = i + 1;
+		}
+		leftover = n - start;
+		if(leftover > 0 && start > 0)
+			memmove(buf, buf + start, leftover);
+		listfile_flush(lf);
+	}
+	if(n < 0) {
+		writer_printf(lf->werr, PREFIX "files-from: read failed (%d): %s\n",
+			errno, herrmsg(msg, sizeof(msg), errno));
+		ATOMIC_ADD(&errors, 1);
+	}
+	if(leftover > 0) {
+		/* the last name may come without a delimiter */
+		buf[leftover] = '\0';
+		listfile_name(lf, buf, leftover);
+	}
+	listfile_flush(lf);
+	if(lf->fd != 0)
+		close(lf->fd);
+	free(buf);
+	if(lf->done != NULL)
+		lf->done(lf->arg);
+	free(lf);
+	return NULL;
+}
+
+int	/* read names from the file, "-" for stdin, on a detached thread. 0 or errno */
+listfile_start(const TCHAR *name, int delim, writer_t *werr, walk_emit_t emit, walk_done_t done, void *arg) {
+	listfile_t *lf;
+	pthread_t tid;
+	int err;
+	if((lf = (listfile_t *) calloc(1, sizeof(listfile_t))) == NULL)
+		return ENOMEM;
+	lf->delim = delim;
+	lf->werr = werr;
+	lf->emit = emit;
+	lf->done = done;
+	lf->arg = arg;
+	if(name[0] == _T('-') && name[1] == 0) {
+		lf->fd = 0;
+#ifdef _WIN32
+		_setmode(0, _O_BINARY);
+#endif
+	} else {
+#ifdef _WIN32
+		if(_wsopen_s(&lf->fd, name, O_RDONLY|_O_BINARY, _SH_DENYWR, _S_IREAD) != 0) {
+#else
+		if((lf->fd = open(name, O_RDONLY)) < 0) {
+#endif
+			err = errno;
+			free(lf);
+			return err;
+		}
+	}
+	if((err = pthread_create(&tid, NULL, listfile_reader, lf)) != 0) {
+		if(lf->fd != 0) close(lf->fd);
+		free(lf);
+		return err;
+	}
+	pthread_detach(tid);
+	return 0;
+}
+
+int	/* # of names or reads that failed */
+listfile_errors() {
+	return errors;
+}
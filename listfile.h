@@ -0,0 +1,15 @@
+#ifndef __LISTFILE_H__
+#define __LISTFILE_H__
+
+/* reads file names from a list file or stdin on a thread of its own,
+ * and hands them out in batches like the directory walker */
+
+#include "hashsumr.h"
+#include "walk.h"
+
+#define	LISTFILE_BUFSIZE	(64<<10)	/* grows for longer names */
+
+int  listfile_start(const TCHAR *name, int delim, writer_t *werr, walk_emit_t emit, walk_done_t done, void *arg);
+int  listfile_errors();
+
+#endif	/* __LISTFILE_H__ */
@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <fcntl.h>
 #include <ctype.h>
@@ -11,6 +12,7 @@
 #endif
 #include "hashsumr.h"
 #include "loadcheck.h"
+#include "hex.h"
 
 #ifdef _WIN32
 wchar_t *
@@ -25,15 +27,6 @@ utf82wchar(char *src, wchar_t *dst, int sz) {
 }
 #endif
 
-int
-is_hex_string(const char *s) {
-	const char *ptr;
-	for(ptr = s; *ptr; ptr++) {
-		if(isxdigit(*ptr) == 0) return 0;
-	}
-	return 1;
-}
-
 int	/* return 0 if not unescaped, otherwise > 0 (# of unescaped chars) */
 unescape(char *input) {
 	int unescaped = 0;
@@ -71,10 +64,12 @@ unescape(char *input) {
 	return unescaped;
 }
 
-int
-process_line(char *line, job_t *job, md_t *alg, int init_mutex) {
-	int escaped = 0;
-	char *ptr, *name, *hash = NULL;
+int	/* fill the last added job of the store from a line */
+process_line(char *line, job_t *job, jobstore_t *jobs, md_t *alg) {
+	md_t *md;
+	int escaped = 0, hlen = -1;
+	char *ptr, *name;
+	unsigned char hash[EVP_MAX_MD_SIZE], *dcheck;	/* decoded once, compared with memcmp */
 #ifdef _WIN32
 	wchar_t buf[4096];
 #endif
@@ -87,86 +82,71 @@ process_line(char *line, job_t *job, md_t *alg, int init_mutex) {
 	do {
 		if((ptr = strrchr(line, ')')) != NULL) {
 			if(strncmp(ptr, ") = ", 4) != 0) break;
-			if(is_hex_string(ptr+4) == 0) break;
-			hash = ptr+4;
+			hlen = hex_decode(ptr+4, hash, sizeof(hash));
 		}
 	} while(0);
 
-	if(hash) {
+	if(hlen > 0) {
 		/* bsd-style - alg (filename) = hash */
 		name = strstr(line, " (");
 		if(name == NULL) return -1;
 		*ptr = '\0';
 		*name = '\0';
 		name += 2;
-		if((job->md = lookup_hash(line)) == NULL) {
-			job->mdname = strdup(line);
+		if((md = lookup_hash(line)) == NULL) {
+			job->mdname = jobstore_strdup(jobs, line);
 		} else {
-			job->mdname = job->md->name;
+			job->mdname = md->name;
 		}
 	} else {
 		/* non-bsd-style - hash; ' '; ' ' or '*'; filename */
 		if((ptr = strchr(line, ' ')) == NULL)  return -1;
 		if(*(ptr+1) != ' ' && *(ptr+1) != '*') return -1;
 		*ptr = '\0';
-		if(is_hex_string(line) == 0) return -1;
-		hash = line;
+		if((hlen = hex_decode(line, hash, sizeof(hash))) < 0) return -1;
 		name = ptr+2;
-		job->md = alg;
+		md = alg;
 		job->mdname = alg->name;
 	}
-	/* fill the rest of job fields */
-	if(init_mutex)
-		pthread_mutex_init(&job->mutex, NULL);
-	job->filename = strdup(name);
+	job->nmd = 1;
+	job->md = md_ref(md);	/* md_ref(NULL) for an unknown algorithm */
+	/* fill the rest of job fields, strings go to the store's arena */
+	if(job->mdname == NULL
+	|| (job->filename = jobstore_strdup(jobs, name)) == NULL
+	|| (dcheck = (unsigned char *) jobstore_alloc(jobs, hlen)) == NULL)
+		return -2;
+	memcpy(dcheck, hash, hlen);
+	job->dcheck = dcheck;
+	job->dchecklen = (unsigned char) hlen;
 	if(escaped)
 		unescape(job->filename);
 #ifdef _WIN32
-	job->wfilename = _wcsdup(utf82wchar(job->filename, buf, sizeof(buf)/sizeof(wchar_t)));
-	strncpy_s(job->dcheck, EVP_MAX_DIGEST_SIZE, hash, _TRUNCATE);
-#else
-	strncpy(job->dcheck, hash, EVP_MAX_DIGEST_SIZE);
+	if((job->wfilename = jobstore_wcsdup(jobs, utf82wchar(job->filename, buf, sizeof(buf)/sizeof(wchar_t)))) == NULL)
+		return -2;
 #endif
 	return 0;
 }
 
-int
-scan_checks(const TCHAR *filename) {
-	int fd;
-	int count_nl = 0;
-	int count_null = 0;
-	size_t sz;
-	char buf[32768];
-#ifdef _WIN32
-	if(_wsopen_s(&fd, filename, O_RDONLY|_O_BINARY, _SH_DENYWR, _S_IREAD) != 0) {
-#else
-	if((fd = open(filename, O_RDONLY)) < 0) {
-#endif
-		return -1;
+static int	/* append the job of one line, -1 if the line is improperly formatted */
+load_line(char *line, jobstore_t *jobs, md_t *alg) {
+	job_t *job;
+	int err = 0;
+	if((job = jobstore_add(jobs)) == NULL
+	|| (err = process_line(line, job, jobs, alg)) == -2) {
+		fprintf(stderr, "hashsumr: load checks: out of memory\n");
+		exit(-1);
 	}
-	while((sz = read(fd, buf, sizeof(buf))) > 0) {
-		size_t i = 0;
-		while (i < sz) {
-			char *p_nl = memchr(buf + i, '\n', sz - i);
-			char *p_null = memchr(buf + i, '\0', sz - i);
-
-			if (!p_nl && !p_null) break;  // no more in this buffer
-
-			if (p_nl && (!p_null || p_nl < p_null)) {
-				count_nl++;
-				i = (p_nl - buf) + 1;
-			} else {
-				count_null++;
-				i = (p_null - buf) + 1;
-			}
-		}
+	if(err != 0) {
+		jobstore_pop(jobs);
+		return -1;
 	}
-	close(fd);
-	return count_nl + count_null + 1;
+	return 0;
 }
 
-int
-load_checks(const TCHAR *filename, job_t *jobs, int njobs, md_t *alg, int init_mutex, int *err) {
+int	/* append the jobs of a check file, publish() is called as they are added.
+	 * return # of jobs, or -1 if the file cannot be opened */
+load_checks(const TCHAR *filename, jobstore_t *jobs, md_t *alg, int *err,
+		load_notify_t publish, void *arg) {
 	int count = 0, error = 0;
 	size_t sz, leftover = 0;
 	FILE *fp;
@@ -185,13 +165,17 @@ load_checks(const TCHAR *filename, job_t *jobs, int njobs, md_t *alg, int init_m
 			if(buf[i] == '\r') buf[i] = '\0';
 			if(buf[i] == '\0' || buf[i] == '\n') {
 				buf[i] = '\0';
-				if(process_line(buf+start, &jobs[count], alg, init_mutex) == 0)
-					count++;
-				else
+				if(load_line(buf+start, jobs, alg) == 0) {
+					if((++count % LOADCHECK_PUBLISH) == 0 && publish != NULL)
+						publish(arg);
+				} else {
 					error++;
+				}
 				start = i + 1;
 			}
 		}
+		if(publish != NULL)
+			publish(arg);
 		/* copy leftover bytes to start of buffer for next iteration */
 		leftover = total - start;
 		if (leftover > 0)
@@ -199,13 +183,82 @@ load_checks(const TCHAR *filename, job_t *jobs, int njobs, md_t *alg, int init_m
 	}
 	if(leftover > 0) {
 		buf[leftover] = '\0';
-		if(process_line(buf, &jobs[count], alg, init_mutex) == 0)
+		if(load_line(buf, jobs, alg) == 0)
 			count++;
 		else
 			error++;
 	}
 	fclose(fp);
+	if(publish != NULL)
+		publish(arg);
 	if(err) *err = error;
 	return count;
 }
 
+typedef struct loader_s {
+	TCHAR **files;
+	int nfiles;
+	jobstore_t *jobs;
+	md_t *alg;
+	writer_t *werr;	/* errors, in order with those of the workers */
+	load_notify_t publish;
+	load_notify_t done;
+	void *arg;
+}	loader_t;
+
+static volatile int linerrors = 0;
+
+static void *
+loader(void *arg) {
+	loader_t *ld = (loader_t *) arg;
+	char msg[128];
+	int i, e;
+	for(i = 0; i < ld->nfiles; i++) {
+		e = 0;
+		if(load_checks(ld->files[i], ld->jobs, ld->alg, &e, ld->publish, ld->arg) < 0) {
+#ifdef _WIN32
+			writer_printf(ld->werr, "hashsumr: %ls: open failed (%d): %s\n",
+#else
+			writer_printf(ld->werr, "hashsumr: %s: open failed (%d): %s\n",
+#endif
+				ld->files[i], errno, herrmsg(msg, sizeof(msg), errno));
+			continue;
+		}
+		ATOMIC_ADD(&linerrors, e);
+	}
+	if(ld->done != NULL)
+		ld->done(ld->arg);
+	free(ld);
+	return NULL;
+}
+
+int	/* load check files on a detached thread, hashing can start with the first lines.
+	 * the loader must be the only one adding jobs. 0 or errno */
+load_checks_start(TCHAR **files, int nfiles, jobstore_t *jobs, md_t *alg, writer_t *werr,
+		load_notify_t publish, load_notify_t done, void *arg) {
+	loader_t *ld;
+	pthread_t tid;
+	int err;
+	if((ld = (loader_t *) malloc(sizeof(loader_t))) == NULL)
+		return ENOMEM;
+	ld->files = files;
+	ld->nfiles = nfiles;
+	ld->jobs = jobs;
+	ld->alg = alg;
+	ld->werr = werr;
+	ld->publish = publish;
+	ld->done = done;
+	ld->arg = arg;
+	if((err = pthread_create(&tid, NULL, loader, ld)) != 0) {
+		free(ld);
+		return err;
+	}
+	pthread_detach(tid);
+	return 0;
+}
+
+int	/* # of improperly formatted lines seen by the loader */
+load_checks_errors() {
+	return linerrors;
+}
+
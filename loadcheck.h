@@ -2,8 +2,17 @@
 #define __LOADCHECK_H__
 
 #include "hashsumr.h"
+#include "jobstore.h"
+#include "writer.h"
 
-int scan_checks(const TCHAR *filename);
-int load_checks(const TCHAR *filename, job_t *jobs, int njobs, md_t *alg, int init_mutex, int *err);
+#define	LOADCHECK_PUBLISH	256	/* publish at least every # of jobs */
+
+typedef void (*load_notify_t)(void *arg);
+
+int load_checks(const TCHAR *filename, jobstore_t *jobs, md_t *alg, int *err,
+		load_notify_t publish, void *arg);
+int load_checks_start(TCHAR **files, int nfiles, jobstore_t *jobs, md_t *alg, writer_t *werr,
+		load_notify_t publish, load_notify_t done, void *arg);
+int load_checks_errors();
 
 #endif
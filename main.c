@@ -5,13 +5,31 @@
 #ifdef _WIN32
 #include <windows.h>
 #include <dbghelp.h>
+#include <io.h>
 #include "getopt.h"
 #else
+#include <unistd.h>
 #include <getopt.h>
 #endif
 #include <errno.h>
+#include <sys/stat.h>
 #include "hashsumr.h"
 #include "loadcheck.h"
+#include "uring.h"
+#include "bufpool.h"
+#include "jobstore.h"
+#include "dispatch.h"
+#include "walk.h"
+#include "listfile.h"
+#include "reorder.h"
+#include "writer.h"
+#include "speed.h"
+#include "stats.h"
+#include "progress.h"
+#include "mbhash.h"
+#ifndef _WIN32
+#include "cache.h"
+#endif
 #include "minibar/minibar.h"
 #include "minibar/pthread_compat/pthread_compat.h"
 
@@ -24,7 +42,9 @@
 #endif
 
 /* options */
-static md_t *opt_alg = NULL;
+static md_t *opt_alg = NULL;	/* the first of opt_algs */
+static md_t *opt_algs[HASHSUMR_MAX_ALGS];
+static int opt_nalgs = 0;
 static int opt_one = 0;
 static int opt_bin = 1;
 static int opt_check = 0;
@@ -32,27 +52,45 @@ static int opt_tag = 1;
 static int opt_zero = 0;
 static int opt_workers = 0;
 static int opt_np = 1;
+static int opt_progress_interval = PROGRESS_INTERVAL;	/* ms */
 static int opt_ignore_missing = 0;
 static int opt_quiet = 0;
 static int opt_status = 0;
 static int opt_strict = 0;
 static int opt_warn = 0;
 static int opt_pause = 0;
+static int opt_schedule = SCHED_INPUT;
+static int opt_perdev = 0;	/* concurrent jobs per device, 0 for no limit */
+static int opt_recursive = 0;
+static walkopt_t opt_walk = { 0, 0 };
+static TCHAR *opt_files_from = NULL;
+static int opt_files_delim = '\n';
+static TCHAR *opt_cache = NULL;
+static int opt_stats = 0;
+static TCHAR *opt_stats_json = NULL;
+static int opt_unordered = 0;
+static int opt_benchmark = 0;
+static int opt_algs_given = 0;	/* -a, --benchmark runs all the algorithms otherwise */
+static int opt_multibuf = MBHASH_AUTO;
 
 /* global state */
-static int    running = 0;
-static int    njobs = 0;
-static job_t *jobs = NULL;
-static int    nextjob = 0;
-static pthread_mutex_t mutex_jobs = PTHREAD_MUTEX_INITIALIZER;
+static jobstore_t jobs;
+static pthread_mutex_t mutex_jobs = PTHREAD_MUTEX_INITIALIZER;	/* for walker threads adding jobs */
+static int producers = 0;	/* walker and list reader, jobs are published until both are done */
+static dispatch_t dispatcher;
+static int   *order = NULL;	/* dispatch order of jobs, NULL for input order */
+static volatile int active = 0;	/* workers still running a job */
+static reorder_t output;	/* prints jobs in input order, unless --unordered */
+static progress_t progress;	/* bars of -p */
+static writer_t wout, werr;	/* results to stdout, check results and errors to stderr */
 static pthread_barrier_t barrier;;
 
-/* hash & check statistics */
-static int hash_done = 0;
-static int hash_err = 0;
-static int hash_missing = 0;
-static int check_ok = 0;
-static int check_failed = 0;
+/* hash & check statistics, updated by workers with ATOMIC_ADD */
+static volatile int hash_done = 0;
+static volatile int hash_err = 0;
+static volatile int hash_missing = 0;
+static volatile int check_ok = 0;
+static volatile int check_failed = 0;
 static int check_linerror = 0;
 
 #ifdef _WIN32
@@ -139,7 +177,8 @@ wchar2utf8_static(wchar_t *s) {
 int
 usage() {
 	fprintf(stderr, "Usage: hashsumr [OPTION]... [FILE]...\n");
-	fprintf(stderr, "Print or check hash-based checksums.\n\n");
+	fprintf(stderr, "Print or check hash-based checksums.\n");
+	fprintf(stderr, "With no FILE, or when FILE is -, read standard input.\n\n");
 	fprintf(stderr, "AVAILABLE ALGORITHMS: (case insensitive)\n ");
 	for(md_t *a = get_hashes(); a != NULL && a->name != NULL; a++) {
 		fprintf(stderr, " %s", a->name);
@@ -148,16 +187,60 @@ usage() {
 	fprintf(stderr, "OPTION: (* - not implemented, for compatibility only)\n");
 	fprintf(stderr, "  -1, --one             classic mode (no progress bar, no workers)\n");
 	fprintf(stderr, "  -a, --algorithm       choose the algorithm (default: %s)\n", opt_alg->name);
+	fprintf(stderr, "                          up to %d comma-separated algorithms can be\n", HASHSUMR_MAX_ALGS);
+	fprintf(stderr, "                          computed in one pass, e.g., SHA256,BLAKE3\n");
 	fprintf(stderr, "  -b, --binary          read in binary mode (default)\n");
 	fprintf(stderr, "  -c, --check           read checksums from the FILEs and check them\n");
-	fprintf(stderr, "      --gnu             create a GNU-style checksum\n");
+	fprintf(stderr, "      --gnu             create a GNU-style checksum, BSD-style lines\n");
+	fprintf(stderr, "                          are kept with more than one algorithm\n");
 	fprintf(stderr, "      --tag             create a BSD-style checksum (default)\n");
 	fprintf(stderr, "  -t, --text            (*) read in text mode\n");
 	fprintf(stderr, "  -z, --zero            end each output line with NUL, not newline,\n");
 	fprintf(stderr, "                          and disable file name escaping\n");
 	fprintf(stderr, "      --workers         set the number or parallel workers\n");
 	fprintf(stderr, "      --np              no progress bar (default)\n");
-	fprintf(stderr, "  -p, --progress        show progress bar\n");
+	fprintf(stderr, "  -p, --progress        show progress bars, one per worker and one for\n");
+	fprintf(stderr, "                          the total with the current rate and ETA\n");
+	fprintf(stderr, "      --progress-interval\n");
+	fprintf(stderr, "                        ms between two progress updates (default: %d)\n", PROGRESS_INTERVAL);
+	fprintf(stderr, "      --unordered       without -p, print each file as soon as it is done\n");
+	fprintf(stderr, "                          instead of in input order\n");
+	fprintf(stderr, "  -r, --recursive       hash the files under directories, hashing starts\n");
+	fprintf(stderr, "                          while the directories are still being read\n");
+	fprintf(stderr, "      --follow-symlinks follow symbolic links under directories with -r\n");
+	fprintf(stderr, "      --one-file-system skip directories on other file systems with -r\n");
+	fprintf(stderr, "      --files-from      hash the files named in a list file, - for stdin;\n");
+	fprintf(stderr, "                          names are read while hashing, and memory does\n");
+	fprintf(stderr, "                          not grow with the list unless -p is given\n");
+	fprintf(stderr, "  -0, --null            names in the --files-from list end with NUL\n");
+	fprintf(stderr, "      --schedule        order to start jobs: input (default),\n");
+	fprintf(stderr, "                          largest-first, or size-balanced (files >= 1MiB\n");
+	fprintf(stderr, "                          largest first, then the rest in input order)\n");
+	fprintf(stderr, "      --per-device-workers\n");
+	fprintf(stderr, "                        max jobs reading from one device at a time, or\n");
+	fprintf(stderr, "                          auto: one for rotational disks, otherwise no limit\n");
+	fprintf(stderr, "                          (--schedule and --per-device-workers need all\n");
+	fprintf(stderr, "                          files up front, ignored with -r or --files-from)\n");
+	fprintf(stderr, "      --io-engine       read (default), mmap (posix), uring (linux), or\n");
+	fprintf(stderr, "                          pipeline (read ahead in a thread, for files >= 1MiB)\n");
+	fprintf(stderr, "      --mmap            same as --io-engine mmap, for files >= 1MiB\n");
+	fprintf(stderr, "      --iodepth         reads in flight per worker for uring (default: %d)\n", hashopt.iodepth);
+	fprintf(stderr, "      --buffer-size     bytes per read, suffix K/M allowed (default: %dK)\n", (int) (hashopt.bufsize>>10));
+	fprintf(stderr, "      --huge-pages      allocate read buffers from huge pages if possible\n");
+	fprintf(stderr, "      --direct          bypass the page cache (O_DIRECT) when possible\n");
+	fprintf(stderr, "      --multi-buffer    auto (default), on, or off: hash SHA256 files up to\n");
+	fprintf(stderr, "                          %dK %d at a time in SIMD lanes, auto turns it on\n", MBHASH_MAX>>10, MBHASH_LANES);
+	fprintf(stderr, "                          for cpus with avx2 but no sha extensions (not\n");
+	fprintf(stderr, "                          with -1, -p, or --direct)\n");
+	fprintf(stderr, "      --cache           keep digests in a cache file and skip reading\n");
+	fprintf(stderr, "                          files whose size, times and inode are unchanged\n");
+	fprintf(stderr, "                          (posix only)\n");
+	fprintf(stderr, "      --verify-cache    hash this percentage of cache hits anyway and\n");
+	fprintf(stderr, "                          fail if a cached digest does not match\n");
+	fprintf(stderr, "      --stats           print per-file time (open, read, hash) percentiles,\n");
+	fprintf(stderr, "                          the slowest files, and worker idle time at the end\n");
+	fprintf(stderr, "      --stats-json      write the timings of each file to a file, one JSON\n");
+	fprintf(stderr, "                          object per line\n");
 	fprintf(stderr, "\n");
 	fprintf(stderr, "The following five options are useful only when verifying checksums:\n");
 	fprintf(stderr, "      --ignore-missing  don't fail or report status for missing files\n");
@@ -168,6 +251,8 @@ usage() {
 	fprintf(stderr, "\n");
 	fprintf(stderr, "  -h, --help            display this help and exit\n");
 	fprintf(stderr, "  -v, --version         output version information and exit\n");
+	fprintf(stderr, "      --benchmark       measure the algorithms (or those of -a) on in-memory\n");
+	fprintf(stderr, "                          buffers, with 1 and --workers (default: all) threads\n");
 	if(opt_pause) {
 		fprintf(stderr, "\nPress any key to exit ...");
 		fflush(stderr);
@@ -180,14 +265,67 @@ usage() {
 #endif
 }
 
-int
-parse_opts(int argc, TCHAR *argv[]) {
+int	/* parse a comma-separated algorithm list, the first one is the primary */
+parse_algs(char *list) {
 	md_t *a;
-	int ch, optidx = 0;
+	char *name, *saveptr = NULL;
+	int i, n = 0;
+#ifdef _WIN32
+#define strtok_r	strtok_s
+#endif
+	for(name = strtok_r(list, ",", &saveptr); name != NULL; name = strtok_r(NULL, ",", &saveptr)) {
+		if((a = lookup_hash(name)) == NULL) {
+			fprintf(stderr, PREFIX "unsupported algorithm `%s'.\n", name);
+			return -1;
+		}
+		for(i = 0; i < n; i++) {
+			if(opt_algs[i] == a) break;
+		}
+		if(i < n) continue;	/* duplicated */
+		if(n >= HASHSUMR_MAX_ALGS) {
+			fprintf(stderr, PREFIX "too many algorithms (max %d).\n", HASHSUMR_MAX_ALGS);
+			return -1;
+		}
+		opt_algs[n++] = a;
+	}
 #ifdef _WIN32
-	char buf[64];
+#undef strtok_r
 #endif
+	if(n == 0) {
+		fprintf(stderr, PREFIX "no algorithm given.\n");
+		return -1;
+	}
+	opt_nalgs = n;
+	opt_alg = opt_algs[0];
+	return n;
+}
+
+long long	/* parse a size with an optional K/M/G suffix, < 0 on error */
+parse_size(const TCHAR *s) {
+	TCHAR *end = NULL;
+	long long sz;
+#ifdef _WIN32
+	sz = _wcstoi64(s, &end, 0);
+#else
+	sz = strtoll(s, &end, 0);
+#endif
+	if(end == s || sz < 0) return -1;
+	switch(*end) {
+	case _T('\0'): break;
+	case _T('k'): case _T('K'): sz <<= 10; break;
+	case _T('m'): case _T('M'): sz <<= 20; break;
+	case _T('g'): case _T('G'): sz <<= 30; break;
+	default: return -1;
+	}
+	return sz;
+}
+
+int
+parse_opts(int argc, TCHAR *argv[]) {
+	int ch, optidx = 0;
+	char buf[256];
 	static struct option opts[] = {
+		{ _T("one-file-system"), no_argument, NULL,     0   },	/* before "one", see getopt.c */
 		{ _T("one"),             no_argument, NULL, _T('1') },
 		{ _T("algorithm"), required_argument, NULL, _T('a') },
 		{ _T("binary"),          no_argument, NULL, _T('b') },
@@ -198,7 +336,27 @@ parse_opts(int argc, TCHAR *argv[]) {
 		{ _T("zero"),            no_argument, NULL, _T('z') },
 		{ _T("workers"),   required_argument, NULL,     0   },
 		{ _T("np"),              no_argument, NULL,     0   },
+		{ _T("progress-interval"), required_argument, NULL, 0 },	/* before "progress" */
 		{ _T("progress"),        no_argument, NULL, _T('p') },
+		{ _T("unordered"),       no_argument, NULL,     0   },
+		{ _T("benchmark"),       no_argument, NULL,     0   },
+		{ _T("recursive"),       no_argument, NULL, _T('r') },
+		{ _T("follow-symlinks"), no_argument, NULL,     0   },
+		{ _T("files-from"), required_argument, NULL,    0   },
+		{ _T("null"),            no_argument, NULL, _T('0') },
+		{ _T("schedule"),  required_argument, NULL,     0   },
+		{ _T("per-device-workers"), required_argument, NULL, 0 },
+		{ _T("mmap"),            no_argument, NULL,     0   },
+		{ _T("io-engine"), required_argument, NULL,     0   },
+		{ _T("iodepth"),   required_argument, NULL,     0   },
+		{ _T("buffer-size"), required_argument, NULL,   0   },
+		{ _T("huge-pages"),      no_argument, NULL,     0   },
+		{ _T("direct"),          no_argument, NULL,     0   },
+		{ _T("multi-buffer"), required_argument, NULL,  0   },
+		{ _T("cache"),     required_argument, NULL,     0   },
+		{ _T("verify-cache"), required_argument, NULL,  0   },
+		{ _T("stats-json"), required_argument, NULL,    0   },	/* before "stats" */
+		{ _T("stats"),           no_argument, NULL,     0   },
 		{ _T("ignore-missing"),  no_argument, NULL,     0   },
 		{ _T("quiet"),           no_argument, NULL, _T('q') },
 		{ _T("status"),          no_argument, NULL,     0   },
@@ -208,7 +366,12 @@ parse_opts(int argc, TCHAR *argv[]) {
 		{ _T("version"),         no_argument, NULL, _T('v') },
 		{ 0, 0 }
 	};
-	if(argc < 2) {
+	/* without arguments, a pipe is hashed and a terminal gets the usage */
+#ifdef _WIN32
+	if(argc < 2 && _isatty(_fileno(stdin))) {
+#else
+	if(argc < 2 && isatty(STDIN_FILENO)) {
+#endif
 		usage();
 		return -1;
 	}
@@ -216,7 +379,7 @@ parse_opts(int argc, TCHAR *argv[]) {
 #define strcmp	wcscmp
 #define strtol	wcstol
 #endif
-	while((ch = getopt_long(argc, argv, _T("1a:bctzpqwhv"), opts, &optidx)) != -1) {
+	while((ch = getopt_long(argc, argv, _T("01a:bctzprqwhv"), opts, &optidx)) != -1) {
 		switch(ch) {
 		case 0: /* for longopts */
 			if(strcmp(opts[optidx].name, _T("tag")) == 0) {
@@ -225,6 +388,90 @@ parse_opts(int argc, TCHAR *argv[]) {
 				opt_tag = 0;
 			} else if(strcmp(opts[optidx].name, _T("np")) == 0) {
 				opt_np = 1;
+			} else if(strcmp(opts[optidx].name, _T("progress-interval")) == 0) {
+				opt_progress_interval = strtol(optarg, NULL, 0);
+				if(opt_progress_interval < 10) opt_progress_interval = 10;
+			} else if(strcmp(opts[optidx].name, _T("benchmark")) == 0) {
+				opt_benchmark = 1;
+			} else if(strcmp(opts[optidx].name, _T("unordered")) == 0) {
+				opt_unordered = 1;
+			} else if(strcmp(opts[optidx].name, _T("schedule")) == 0) {
+				if(strcmp(optarg, _T("input")) == 0) {
+					opt_schedule = SCHED_INPUT;
+				} else if(strcmp(optarg, _T("largest-first")) == 0) {
+					opt_schedule = SCHED_LARGEST_FIRST;
+				} else if(strcmp(optarg, _T("size-balanced")) == 0) {
+					opt_schedule = SCHED_SIZE_BALANCED;
+				} else {
+					fprintf(stderr, PREFIX "unsupported schedule.\n");
+					exit(-1);
+				}
+			} else if(strcmp(opts[optidx].name, _T("per-device-workers")) == 0) {
+				if(strcmp(optarg, _T("auto")) == 0) {
+					opt_perdev = DISPATCH_AUTO;
+				} else {
+					opt_perdev = strtol(optarg, NULL, 0);
+					if(opt_perdev < 0) opt_perdev = 0;
+				}
+			} else if(strcmp(opts[optidx].name, _T("follow-symlinks")) == 0) {
+				opt_walk.follow = 1;
+			} else if(strcmp(opts[optidx].name, _T("one-file-system")) == 0) {
+				opt_walk.xdev = 1;
+			} else if(strcmp(opts[optidx].name, _T("files-from")) == 0) {
+				opt_files_from = optarg;
+			} else if(strcmp(opts[optidx].name, _T("mmap")) == 0) {
+				hashopt.engine = IOENGINE_MMAP;
+			} else if(strcmp(opts[optidx].name, _T("io-engine")) == 0) {
+				if(strcmp(optarg, _T("read")) == 0) {
+					hashopt.engine = IOENGINE_READ;
+				} else if(strcmp(optarg, _T("mmap")) == 0) {
+					hashopt.engine = IOENGINE_MMAP;
+				} else if(strcmp(optarg, _T("uring")) == 0) {
+					hashopt.engine = IOENGINE_URING;
+				} else if(strcmp(optarg, _T("pipeline")) == 0) {
+					hashopt.engine = IOENGINE_PIPELINE;
+				} else {
+					fprintf(stderr, PREFIX "unsupported i/o engine.\n");
+					exit(-1);
+				}
+			} else if(strcmp(opts[optidx].name, _T("multi-buffer")) == 0) {
+				if(strcmp(optarg, _T("auto")) == 0) {
+					opt_multibuf = MBHASH_AUTO;
+				} else if(strcmp(optarg, _T("on")) == 0) {
+					opt_multibuf = MBHASH_ON;
+				} else if(strcmp(optarg, _T("off")) == 0) {
+					opt_multibuf = MBHASH_OFF;
+				} else {
+					fprintf(stderr, PREFIX "unsupported multi-buffer mode.\n");
+					exit(-1);
+				}
+			} else if(strcmp(opts[optidx].name, _T("iodepth")) == 0) {
+				hashopt.iodepth = strtol(optarg, NULL, 0);
+				if(hashopt.iodepth < 1) hashopt.iodepth = 1;
+				if(hashopt.iodepth > URING_MAX_DEPTH) hashopt.iodepth = URING_MAX_DEPTH;
+			} else if(strcmp(opts[optidx].name, _T("buffer-size")) == 0) {
+				long long sz = parse_size(optarg);
+				if(sz < BUFPOOL_MIN_SIZE || sz > BUFPOOL_MAX_SIZE) {
+					fprintf(stderr, PREFIX "buffer size must be between %dK and %dM.\n",
+						BUFPOOL_MIN_SIZE>>10, BUFPOOL_MAX_SIZE>>20);
+					exit(-1);
+				}
+				/* keep reads aligned for O_DIRECT */
+				hashopt.bufsize = ((size_t) sz + BUFPOOL_ALIGN - 1) & ~((size_t) BUFPOOL_ALIGN - 1);
+			} else if(strcmp(opts[optidx].name, _T("huge-pages")) == 0) {
+				hashopt.hugepages = 1;
+			} else if(strcmp(opts[optidx].name, _T("direct")) == 0) {
+				hashopt.direct = 1;
+			} else if(strcmp(opts[optidx].name, _T("cache")) == 0) {
+				opt_cache = optarg;
+			} else if(strcmp(opts[optidx].name, _T("stats-json")) == 0) {
+				opt_stats_json = optarg;
+			} else if(strcmp(opts[optidx].name, _T("stats")) == 0) {
+				opt_stats = 1;
+			} else if(strcmp(opts[optidx].name, _T("verify-cache")) == 0) {
+				hashopt.verify = strtol(optarg, NULL, 0);
+				if(hashopt.verify < 0) hashopt.verify = 0;
+				if(hashopt.verify > 100) hashopt.verify = 100;
 			} else if(strcmp(opts[optidx].name, _T("workers")) == 0) {
 				opt_workers = strtol(optarg, NULL, 0);
 				if(opt_workers < 0) opt_workers = 0;
@@ -237,28 +484,24 @@ parse_opts(int argc, TCHAR *argv[]) {
 				opt_strict = 1;
 			}
 			break;
+		case _T('0'):
+			opt_files_delim = '\0';
+			break;
 		case _T('1'):
 			opt_one = 1;
 			break;
 		case _T('a'):
-			for(a = get_hashes(); a->name != NULL; a++) {
 #ifdef _WIN32
-				if(_stricmp(a->name, wchar2utf8(optarg, buf, sizeof(buf))) == 0) {
-#else
-				if(strcasecmp(a->name, optarg) == 0) {
-#endif
-					opt_alg = a;
-					break;
-				}
+			if(wchar2utf8(optarg, buf, sizeof(buf)) == NULL) {
+				fprintf(stderr, PREFIX "invalid algorithm list.\n");
+				exit(-1);
 			}
-			if(a->name == NULL) {
-#ifdef _WIN32
-				fprintf(stderr, PREFIX "unsupported algorithm `%s'.\n", wchar2utf8(optarg, buf, sizeof(buf)));
 #else
-				fprintf(stderr, PREFIX "unsupported algorithm `%s'.\n", optarg);
+			snprintf(buf, sizeof(buf), "%s", optarg);
 #endif
+			if(parse_algs(buf) < 0)
 				exit(-1);
-			}
+			opt_algs_given = 1;
 			break;
 		case _T('b'):
 			opt_bin = 1;
@@ -275,6 +518,9 @@ parse_opts(int argc, TCHAR *argv[]) {
 		case _T('p'):
 			opt_np = 0;
 			break;
+		case _T('r'):
+			opt_recursive = 1;
+			break;
 		case _T('q'):
 			opt_quiet = 1;
 			opt_np = 1;
@@ -296,6 +542,9 @@ parse_opts(int argc, TCHAR *argv[]) {
 			break;
 		}
 	}
+	/* untagged lines cannot tell several algorithms apart */
+	if(opt_nalgs > 1)
+		opt_tag = 1;
 	argc -= optind;
 	argv += optind;
 	return optind;
@@ -366,19 +615,18 @@ escape(char *input, char *output, int outlen) {
 void
 print_check1(job_t *job) {
 	if(job->code == STATE_DONE) {
-#ifdef _WIN32
-		int ok = (_stricmp(job->dcheck, job->digest) == 0);
-#else
-		int ok = (strcasecmp(job->dcheck, job->digest) == 0);
-#endif
+		int ok = job->dchecklen == job->hashlen[0]
+			&& memcmp(job->dcheck, job_hash(job, 0), job->dchecklen) == 0;
 		if(ok) {
-			check_ok++;
+			ATOMIC_ADD(&check_ok, 1);
 		} else {
-			check_failed++;
+			ATOMIC_ADD(&check_failed, 1);
 		}
+		if(job->errmsg != NULL)	/* --verify-cache replaced the cached digest */
+			writer_printf(&werr, PREFIX "%s: %s\n", job->filename, job->errmsg);
 		if(opt_status || (ok && opt_quiet)) return;
-		fprintf(stderr, "(%s) %s: %s\n",
-			job->md->name,
+		writer_printf(&werr, "(%s) %s: %s\n",
+			job->md[0]->name,
 			job->filename, ok ? "OK" : "FAILED");
 		return;
 	}
@@ -386,16 +634,17 @@ print_check1(job_t *job) {
 		return;
 	if(job->code == ERR_MISSING && opt_ignore_missing)
 		return;
-	fprintf(stderr, "(%s) %s: %s\n",
-		job->md == NULL ? job->mdname : job->md->name,
+	writer_printf(&werr, "(%s) %s: %s\n",
+		job->md[0] == NULL ? job->mdname : job->md[0]->name,
 		job->filename,
 		job->errmsg);
 }
 
 int
 return_value() {
+	int stale = hash_cache_mismatches();	/* --verify-cache found a bad entry */
 	if(opt_check == 0) {
-		return (hash_err + hash_missing > 0) ? 1 : 0;
+		return (hash_err + hash_missing + stale > 0) ? 1 : 0;
 	}
 	if(opt_status == 0 && opt_warn && check_linerror > 0) {
 		fprintf(stderr, PREFIX "WARNING: %d line is improperly formatted\n", check_linerror);
@@ -406,126 +655,238 @@ return_value() {
 	if(opt_strict && check_linerror > 0)
 		return 1;
 	if(opt_ignore_missing)
-		return (check_failed > 0) ? 1 : 0;
-	return (check_failed + hash_missing> 0) ? 1 : 0;
+		return (check_failed + stale > 0) ? 1 : 0;
+	return (check_failed + hash_missing + stale > 0) ? 1 : 0;
 }
 
 void
-print_check(int n, job_t *jobs) {
-	for(int i = 0; i < n; i++) {
-		print_check1(&jobs[i]);
+print_check(jobstore_t *jobs) {
+	for(int i = 0; i < jobs->count; i++) {
+		print_check1(JOBSTORE_AT(jobs, i));
 	}
 }
 
 void
 print_digest1(job_t *job) {
-	int escaped;
+	int i, escaped;
 	char EOL = opt_zero ? '\0' : '\n';
 	char escname[PATH_MAX];
+	char hex[EVP_MAX_DIGEST_SIZE];
 	escaped = escape(job->filename, escname, sizeof(escname));
 	if(job->code == STATE_UNKNOWN) {
-		fprintf(stderr, "%s: INVALID JOB STATE, PLEASE REPORT!\n", escname);
+		writer_printf(&werr, "%s: INVALID JOB STATE, PLEASE REPORT!\n", escname);
 		return;
 	}
 	if(job->code != STATE_DONE) {
-		fprintf(stderr, PREFIX "%s: %s\n", escname, job->errmsg);
+		writer_printf(&werr, PREFIX "%s: %s\n", escname, job->errmsg);
 		return;
 	}
-	if(opt_tag == 0) {
-		printf("%s%s %c%s%c",
-			escaped > 0 ? "\\" : "",
-			job->digest,
-			opt_bin ? '*' : ' ',
-			escname, EOL);
-	} else {
-		printf("%s%s (%s) = %s%c",
-			escaped > 0 ? "\\" : "",
-			job->md->name, escname, job->digest, EOL);
+	if(job->errmsg != NULL)	/* --verify-cache replaced the cached digest */
+		writer_printf(&werr, PREFIX "%s: %s\n", escname, job->errmsg);
+	for(i = 0; i < job->nmd; i++) {
+		digest(job_hash(job, i), job->hashlen[i], hex, sizeof(hex));
+		if(opt_tag == 0) {
+			writer_printf(&wout, "%s%s %c%s%c",
+				escaped > 0 ? "\\" : "",
+				hex,
+				opt_bin ? '*' : ' ',
+				escname, EOL);
+		} else {
+			writer_printf(&wout, "%s%s (%s) = %s%c",
+				escaped > 0 ? "\\" : "",
+				job->md[i]->name, escname, hex, EOL);
+		}
 	}
 }
 
 void
-print_digest(int njobs, job_t *jobs) {
-	for(int i = 0; i < njobs; i++) {
-		print_digest1(&jobs[i]);
+print_digest(jobstore_t *jobs) {
+	for(int i = 0; i < jobs->count; i++) {
+		print_digest1(JOBSTORE_AT(jobs, i));
 	}
 }
 
-void
-vzupdater(job_t *job, void *arg) {
-	minibar_t *bar = (minibar_t*) arg;
-	minibar_setvalue(bar, ((double) job->checked / (double) job->filesz) * 100.0);
+int	/* "-" names stdin, as a file to hash or a list */
+is_stdin(const TCHAR *name) {
+	return name[0] == _T('-') && name[1] == 0;
 }
 
-void *
-visualizer(void *__) {
-	while(running) {
-		minibar_refresh();
+job_t *	/* append a job to hash the file, frees name if own is set */
+add_job(TCHAR *name, int own) {
+	job_t *job;
+	char msg[128];
 #ifdef _WIN32
-		Sleep(1000);
+	char *utf8;
+	if((job = jobstore_add(&jobs)) == NULL
+	|| (job->wfilename = jobstore_wcsdup(&jobs, name)) == NULL
+	|| (utf8 = wchar2utf8_alloc(name)) == NULL
+	|| (job->filename = jobstore_strdup(&jobs, utf8)) == NULL) {
 #else
-		sleep(1);
+	if((job = jobstore_add(&jobs)) == NULL
+	|| (job->filename = jobstore_strdup(&jobs, name)) == NULL) {
 #endif
+		fprintf(stderr, PREFIX "add job failed (%d): %s\n",
+				errno,
+				herrmsg(msg, sizeof(msg), errno));
+		exit(-1);
 	}
-	return NULL;
+#ifdef _WIN32
+	free(utf8);
+#endif
+	if(own) free(name);
+	job->nmd = opt_nalgs;
+	job->md = opt_algs;
+	return job;
+}
+
+void	/* walker or list reader: files found */
+producer_emit(TCHAR **paths, int n, void *__) {
+	int i;
+	pthread_mutex_lock(&mutex_jobs);
+	for(i = 0; i < n; i++)
+		add_job(paths[i], 1);
+	dispatch_publish(&dispatcher, jobs.count);
+	pthread_mutex_unlock(&mutex_jobs);
+}
+
+void	/* check file loader: jobs added */
+producer_publish(void *__) {
+	pthread_mutex_lock(&mutex_jobs);
+	dispatch_publish(&dispatcher, jobs.count);
+	pthread_mutex_unlock(&mutex_jobs);
+}
+
+void	/* walker, list reader, or check file loader: no more jobs */
+producer_done(void *__) {
+	if(ATOMIC_ADD(&producers, -1) == 1)
+		dispatch_close(&dispatcher);
+}
+
+void	/* a job is printed, let a bounded job store reuse its memory */
+release_job(int idx) {
+	jobstore_release(&jobs, idx);
+}
+
+void	/* reorder window: the next job in input order and all before it are done */
+output_job(int i, void *__) {
+	if(opt_check == 0) {
+		print_digest1(JOBSTORE_AT(&jobs, i));
+	} else {
+		print_check1(JOBSTORE_AT(&jobs, i));
+	}
+	release_job(i);
+}
+
+int	/* 1 if a job qualifies for hash_split(), its idle workers then help */
+split_job() {
+	unsigned long long fsize;
+	int i, ftype;
+	for(i = 0; i < jobs.count; i++) {
+		job_t *job = JOBSTORE_AT(&jobs, i);
+		if(job->nmd != 1 || job->md == NULL || job->md[0] == NULL
+		|| strcmp(job->md[0]->name, "BLAKE3") != 0)
+			continue;
+#ifdef _WIN32
+		if(get_fileinfo(job->wfilename, &fsize, &ftype, NULL) != 0)
+#else
+		if(get_fileinfo(job->filename, &fsize, &ftype, NULL) != 0)
+#endif
+			continue;
+		if(ftype == S_IFREG && fsize > 2 * HASHSUMR_SPLIT_SIZE)
+			return 1;
+	}
+	return 0;
+}
+
+void	/* --stats: add the time since *mark to *sum */
+lap(unsigned long long *mark, unsigned long long *sum) {
+	unsigned long long t;
+	if(hashopt.stats == NULL) return;
+	t = stats_now();
+	*sum += t - *mark;
+	*mark = t;
+}
+
+void	/* a worker finished a job: count it, then print it or pass it to the reorder window */
+finish_job(int idx, int id, batch_t *batch) {
+	job_t *job = JOBSTORE_AT(&jobs, order != NULL ? order[idx] : idx);
+	dispatch_done(&dispatcher, idx);
+	dispatch_feedback(batch, job->filesz == HASHSUMR_SIZE_UNKNOWN ? job->checked : job->filesz);
+	/* update statistics */
+	if(job->code == STATE_DONE) {
+		ATOMIC_ADD(&hash_done, 1);
+	} else if(job->code == ERR_MISSING) {
+		ATOMIC_ADD(&hash_missing, 1);
+	} else {
+		ATOMIC_ADD(&hash_err, 1);
+	}
+	/* output */
+	if(opt_np == 0) {
+		minibar_complete(progress_end(&progress, id));
+	} else if(opt_unordered == 0) {
+		/* by job number, --schedule only changes the dispatch order */
+		reorder_done(&output, order != NULL ? order[idx] : idx);	/* printed and released by output_job() */
+		return;
+	} else if(opt_check == 0) {
+		print_digest1(job);
+	} else {
+		print_check1(job);
+	}
+	release_job(order != NULL ? order[idx] : idx);
 }
 
 void *
-worker(void *__) {
-	visualizer_t updater = vzupdater;
+worker(void *arg) {
 	job_t *job;
-	if(opt_np) updater = NULL;
+	batch_t batch;
+	int i, idx, id = (int) (size_t) arg;
+	int pending[MBHASH_JOBS], npending = 0;	/* gathered for hash_flush() */
+	unsigned long long mark = 0, busy = 0, idle = 0, outwait = 0;
+	dispatch_batch_init(&batch);
+	if(hashopt.stats != NULL) mark = stats_now();
 	while(1) {
-		minibar_t *bar = NULL;
+		lap(&mark, &outwait);	/* printing the previous job */
 		/* get a job */
-		pthread_mutex_lock(&mutex_jobs);
-		if(nextjob < njobs) {
-			job = &jobs[nextjob++];
-		} else {
-			job = NULL;
+		if((idx = dispatch_next(&dispatcher, &batch)) < 0) {
+			lap(&mark, &idle);
+			/* help with large files still running on other workers */
+			ATOMIC_ADD(&active, -1);
+			hash_help_wakeup();
+			hash_help(&active);
+			lap(&mark, &busy);
+			goto quit;
 		}
-		pthread_mutex_unlock(&mutex_jobs);
-		if(job == NULL) goto quit;
+		lap(&mark, &idle);
+		job = JOBSTORE_AT(&jobs, order != NULL ? order[idx] : idx);
 		/* run the job */
 		if(opt_np == 0)
-			bar = minibar_get(job->filename);
-		hash1(job, updater, bar);
-		/* update statistics */
-		if(job->code == STATE_DONE) {
-			hash_done++;
-		} else if(job->code == ERR_MISSING) {
-			hash_missing++;
-		} else {
-			hash_err++;
-		}
-		/* output */
-		if(opt_np == 0) {
-			minibar_complete(bar);
-		} else if(opt_check == 0) {
-			print_digest1(job);
-		} else {
-			print_check1(job);
+			progress_begin(&progress, id, job, minibar_get(job->filename));
+		hash1(job, NULL, NULL);
+		if(job->code != STATE_PENDING) {
+			lap(&mark, &busy);
+			finish_job(idx, id, &batch);
+			continue;
 		}
+		/* small files are gathered while more are claimed, never
+		 * while waiting for jobs, others may wait for their output */
+		pending[npending++] = idx;
+		if(npending < MBHASH_JOBS && dispatch_ready(&dispatcher, &batch))
+			continue;
+		hash_flush();
+		lap(&mark, &busy);
+		for(i = 0; i < npending; i++)
+			finish_job(pending[i], id, &batch);
+		npending = 0;
 	}
 quit:
+	if(hashopt.stats != NULL)
+		stats_worker(hashopt.stats, id, busy, idle, outwait);
+	bufpool_release();
+	hash_release();
 	pthread_barrier_wait(&barrier);
 	return NULL;
 }
 
-job_t *
-jobs_alloc(int n) {
-	job_t *mem;
-	char msg[128];
-	if((mem = (job_t *) malloc(sizeof(job_t) * n)) == NULL) {
-		fprintf(stderr, PREFIX "malloc failed (%d): %s\n",
-				errno,
-				herrmsg(msg, sizeof(msg), errno));
-		return NULL;
-	}
-	memset(mem, 0, sizeof(job_t) * n);
-	return mem;
-}
-
 #ifdef _WIN32
 wchar_t **
 append_argv(wchar_t *value, wchar_t **argv, int *argc, int *sz) {
@@ -654,6 +1015,10 @@ main(int argc, char *argv[]) {
 	int i, idx, err;
 	int ncores;
 	char msg[128];
+	unsigned long long *devs = NULL;	/* device of each job */
+	TCHAR **roots = NULL;	/* directories for -r */
+	int nroots = 0;
+	int nmanifests = 0;	/* check files loaded while hashing */
 	pthread_t tid;
 #ifdef _WIN32
 	SetUnhandledExceptionFilter(my_crash_handler);
@@ -672,6 +1037,8 @@ main(int argc, char *argv[]) {
 		return -1;
 #endif
 	}
+	opt_algs[0] = opt_alg;
+	opt_nalgs = 1;
 #ifdef _WIN32
 	if((argv = expand_args(&argc, argv)) == NULL) {
 		fprintf(stderr, PREFIX "FATAL: expand args failed.\n");
@@ -690,78 +1057,262 @@ main(int argc, char *argv[]) {
 #endif
 	}
 
-	if(argc - idx <= 0) {
+	if(opt_benchmark) {
+		md_t **algs = opt_algs, *a;
+		int nalgs = opt_nalgs;
+		if(opt_algs_given == 0) {
+			for(a = get_hashes(), nalgs = 0; a->name != NULL; a++)
+				nalgs++;
+			if((algs = (md_t **) malloc(sizeof(md_t *) * nalgs)) == NULL) {
+				fprintf(stderr, PREFIX "FATAL: malloc failed.\n");
+				exit(-1);
+			}
+			for(a = get_hashes(), nalgs = 0; a->name != NULL; a++)
+				algs[nalgs++] = a;
+		}
+		fprintf(stderr, PREFIX "version " VERSION "; %d processor(s) detected.\n", ncores);
+		return speed_run(algs, nalgs, opt_workers > 0 ? opt_workers : ncores) == 0 ? 0 : 1;
+	}
+
+	if(opt_files_from != NULL && opt_check) {
+		fprintf(stderr, PREFIX "--files-from cannot be used with -c.\n");
+		return usage();
+	}
+	if(argc - idx <= 0 && opt_files_from == NULL && opt_check) {
 		fprintf(stderr, PREFIX "no file given.\n");
 		return usage();
 	}
 
+	if(jobstore_init(&jobs) < 0) {
+		fprintf(stderr, PREFIX "FATAL: job store init failed.\n");
+		exit(-1);
+	}
 	if(opt_check == 0) {
-		njobs = argc - idx;
-		if((jobs = jobs_alloc(njobs)) == NULL) exit(-1);
-		for(i = 0; i < njobs; i++) {
-			if(opt_one == 0)
-				pthread_mutex_init(&jobs[i].mutex, NULL);
-			jobs[i].md = opt_alg;
+		if((roots = (TCHAR **) malloc(sizeof(TCHAR *) * (argc - idx + 1))) == NULL) {
+			fprintf(stderr, PREFIX "FATAL: malloc failed.\n");
+			exit(-1);
+		}
+		for(i = idx; i < argc; i++) {
+			unsigned long long fsize;
+			int ftype;
+			/* directories are walked after the files given explicitly */
+			if(opt_recursive && get_fileinfo(argv[i], &fsize, &ftype, NULL) == 0 && ftype == S_IFDIR) {
+				roots[nroots++] = argv[i];
+				continue;
+			}
+			if(opt_files_from != NULL && is_stdin(opt_files_from) && is_stdin(argv[i])) {
+				fprintf(stderr, PREFIX "stdin cannot be both the file list and a file to hash.\n");
+				exit(-1);
+			}
+			add_job(argv[i], 0);
+		}
+		/* like sha256sum, no files means stdin */
+		if(argc - idx <= 0 && opt_files_from == NULL)
+			add_job(_T("-"), 0);
+	} else if(opt_schedule != SCHED_INPUT || opt_perdev != 0) {
+		/* scheduling needs all jobs before the first one starts */
+		for(i = idx; i < argc; i++) {
+			int n, e = 0;
+			if((n = load_checks(argv[i], &jobs, opt_alg, &e, NULL, NULL)) < 0) {
+				fprintf(stderr, PREFIX "%s: open failed (%d): %s\n",
 #ifdef _WIN32
-			jobs[i].wfilename = _wcsdup(argv[idx+i]);
-			jobs[i].filename = wchar2utf8_alloc(argv[idx+i]);
+					wchar2utf8_static(argv[i]),
 #else
-			jobs[i].filename = strdup(argv[idx+i]);
+					argv[i],
 #endif
+					errno, herrmsg(msg, sizeof(msg), errno));
+				continue;
+			}
+			check_linerror += e;
 		}
 	} else {
-		/* TODO */
-		int files = argc - idx;
-		int estjobs = 0;
-		for(i = 0; i < files; i++) {
-			int n = scan_checks(argv[idx+i]);
-			if(n < 0) {
-				fprintf(stderr, PREFIX "%s: open for scanning failed (%d): %s\n",
+		/* loaded while hashing, see below */
+		nmanifests = argc - idx;
+	}
+
 #ifdef _WIN32
-					wchar2utf8_static(argv[idx+i]),
+	if(hashopt.engine != IOENGINE_PIPELINE)
+		hashopt.engine = IOENGINE_READ;
+	if(opt_perdev != 0) {
+		fprintf(stderr, PREFIX "per-device workers are not supported, ignored.\n");
+		opt_perdev = 0;
+	}
+	if(opt_cache != NULL) {
+		fprintf(stderr, PREFIX "--cache is not supported, ignored.\n");
+		opt_cache = NULL;
+	}
 #else
-					argv[idx+i],
+	if(hashopt.engine == IOENGINE_URING && uring_available() == 0) {
+		fprintf(stderr, PREFIX "io_uring is not available, use read instead.\n");
+		hashopt.engine = IOENGINE_READ;
+	}
+	if(opt_cache != NULL && (hashopt.cache = cache_open(opt_cache)) == NULL) {
+		fprintf(stderr, PREFIX "%s: open cache failed (%d): %s\n", opt_cache,
+			errno, errno == EINVAL ? "not a hashsumr cache" : herrmsg(msg, sizeof(msg), errno));
+		exit(-1);
+	}
 #endif
+	if((opt_stats || opt_stats_json != NULL) && (hashopt.stats = stats_open(opt_stats_json)) == NULL) {
+		fprintf(stderr, PREFIX "%s: open failed (%d): %s\n",
+#ifdef _WIN32
+			opt_stats_json != NULL ? wchar2utf8_static(opt_stats_json) : "stats",
+#else
+			opt_stats_json != NULL ? opt_stats_json : "stats",
+#endif
+			errno, herrmsg(msg, sizeof(msg), errno));
+		exit(-1);
+	}
+	producers = (nroots > 0) + (opt_files_from != NULL) + (nmanifests > 0);
+	if(producers > 0 && (opt_schedule != SCHED_INPUT || opt_perdev != 0)) {
+		fprintf(stderr, PREFIX "--schedule and --per-device-workers are ignored with -r or --files-from.\n");
+		opt_schedule = SCHED_INPUT;
+		opt_perdev = 0;
+	}
+	/* printed jobs are dropped, unless the progress bar prints them all at the end */
+	if(producers > 0 && (opt_np || opt_one) && jobstore_bound(&jobs, JOBSTORE_BOUND) < 0) {
+		fprintf(stderr, PREFIX "FATAL: job store init failed.\n");
+		exit(-1);
+	}
+
+	/* fewer files than workers: no more workers than files, unless idle
+	 * workers can help with a large blake3 file, then one per processor */
+	if(opt_one == 0 && producers == 0 && jobs.count < (opt_workers > 0 ? opt_workers : ncores) && split_job()) {
+		if(opt_workers < ncores) opt_workers = ncores;
+	} else {
+		if(opt_workers <= 0) opt_workers = 1 + (ncores>>1);
+		if(opt_workers > jobs.count && producers == 0) opt_workers = jobs.count;
+	}
+	fprintf(stderr, PREFIX "%d processor(s) detected; workers = %d;"
+		" algorithm = %s", ncores, opt_workers, opt_alg->name);
+	for(i = 1; i < opt_nalgs; i++) {
+		fprintf(stderr, ",%s", opt_algs[i]->name);
+	}
+	fprintf(stderr, ".\n");
+
+	/* dispatch order, outputs still follow the input order */
+	if(opt_one == 0 && (opt_schedule != SCHED_INPUT || opt_perdev != 0)) {
+		if((devs = (unsigned long long *) malloc(sizeof(unsigned long long) * jobs.count)) == NULL) {
+			fprintf(stderr, PREFIX "malloc failed (%d): %s\n",
+				errno, herrmsg(msg, sizeof(msg), errno));
+			abort();
+		}
+		for(i = 0; i < jobs.count; i++) {
+			job_t *job = JOBSTORE_AT(&jobs, i);
+			int ftype;
+			devs[i] = 0;
+#ifdef _WIN32
+			get_fileinfo(job->wfilename, &job->filesz, &ftype, &devs[i]);
+#else
+			get_fileinfo(job->filename, &job->filesz, &ftype, &devs[i]);
+#endif
+		}
+		order = dispatch_order(&jobs, opt_schedule);
+	}
+	dispatch_init(&dispatcher, jobs.count, opt_one ? 1 : opt_workers);
+	if(opt_one == 0 && opt_perdev != 0) {
+		unsigned long long *bydispatch = devs;
+		int limited;
+		if(order != NULL) {
+			/* the dispatcher counts in dispatch order */
+			if((bydispatch = (unsigned long long *) malloc(sizeof(unsigned long long) * jobs.count)) == NULL) {
+				fprintf(stderr, PREFIX "malloc failed (%d): %s\n",
 					errno, herrmsg(msg, sizeof(msg), errno));
-				continue;
+				abort();
 			}
-			estjobs += n;
+			for(i = 0; i < jobs.count; i++)
+				bydispatch[i] = devs[order[i]];
 		}
-		if((jobs = jobs_alloc(estjobs)) == NULL) exit(-1);
-		for(i = 0; i < files; i++) {
-			int n, e = 0;
-			n = load_checks(argv[idx+i], &jobs[njobs], estjobs-njobs, opt_alg, opt_one == 0, &e);
-			if(n < 0) continue;
-			njobs += n;
-			check_linerror += e;
+		if((limited = dispatch_limit_devices(&dispatcher, bydispatch, opt_perdev)) < 0) {
+			fprintf(stderr, PREFIX "per-device setup failed, ignored.\n");
+		} else if(limited > 0) {
+			fprintf(stderr, PREFIX "limited workers on %d of %d device(s).\n",
+				limited, dispatcher.ndevices);
+			/* parallel pieces of one file would seek just the same */
+			for(i = 0; i < jobs.count; i++)
+				JOBSTORE_AT(&jobs, order != NULL ? order[i] : i)->serial = dispatch_limited(&dispatcher, i);
+		}
+		if(bydispatch != devs)
+			free(bydispatch);
+	}
+	/* workers only format their lines, writer threads do the i/o.
+	 * started before any other thread writes to stdout or stderr.
+	 * if a writer cannot start, lines are written directly */
+	writer_start(&wout, stdout);
+	writer_start(&werr, stderr);
+	/* walk directories, read the list, or load check files,
+	 * workers pick up jobs as they are found */
+	if(producers > 0)
+		dispatch_stream(&dispatcher);
+	if(nmanifests > 0) {
+		if((err = load_checks_start(&argv[idx], nmanifests, &jobs, opt_alg, &werr,
+				producer_publish, producer_done, NULL)) != 0) {
+			fprintf(stderr, PREFIX "create loader thread failed (%d): %s\n",
+				err, herrmsg(msg, sizeof(msg), err));
+			abort();
+		}
+	}
+	if(opt_files_from != NULL) {
+		if((err = listfile_start(opt_files_from, opt_files_delim, &werr,
+				producer_emit, producer_done, NULL)) != 0) {
+			fprintf(stderr, PREFIX "%s: open failed (%d): %s\n",
+#ifdef _WIN32
+				wchar2utf8_static(opt_files_from),
+#else
+				opt_files_from,
+#endif
+				err, herrmsg(msg, sizeof(msg), err));
+			ATOMIC_ADD(&hash_err, 1);
+			producer_done(NULL);
+		}
+	}
+	if(nroots > 0) {
+		if((err = walk_start(roots, nroots, opt_one ? 1 : opt_workers, &opt_walk, &werr,
+				producer_emit, producer_done, NULL)) != 0) {
+			fprintf(stderr, PREFIX "create walker thread failed (%d): %s\n",
+				err, herrmsg(msg, sizeof(msg), err));
+			abort();
 		}
 	}
-
-	if(opt_workers <= 0) opt_workers = 1 + (ncores>>1);
-	if(opt_workers > njobs) opt_workers = njobs;
-	fprintf(stderr, PREFIX "%d processor(s) detected; workers = %d;"
-		" algorithm = %s"
-		".\n", ncores, opt_workers, opt_alg->name);
 
 	if(opt_one) {
-		for(i = 0; i < njobs; i++) {
-			hash1(&jobs[i], NULL, NULL);
+		batch_t batch;
+		dispatch_batch_init(&batch);
+		while((i = dispatch_next(&dispatcher, &batch)) >= 0) {
+			job_t *job = JOBSTORE_AT(&jobs, i);
+			hash1(job, NULL, NULL);
 			if(opt_check) {
-				print_check1(&jobs[i]);
+				print_check1(job);
 			} else {
-				print_digest1(&jobs[i]);
+				print_digest1(job);
 			}
+			release_job(i);
 		}
-	} else if(njobs > 0) {
+	} else if(jobs.count > 0 || producers > 0) {
 		if(opt_np == 0) {
-			if(minibar_open(stderr, opt_workers) < 0) {
+			unsigned long long total = 0;
+			/* the sizes of all files for the overall bar, unless
+			 * -r or --files-from still find them while hashing */
+			for(i = 0; producers == 0 && i < jobs.count; i++) {
+				job_t *job = JOBSTORE_AT(&jobs, i);
+				unsigned long long fsize = 0;
+				int ftype = S_IFREG;
+				if(devs != NULL) {
+					fsize = job->filesz;	/* from the schedule above */
+#ifdef _WIN32
+				} else if(get_fileinfo(job->wfilename, &fsize, &ftype, NULL) != 0) {
+#else
+				} else if(get_fileinfo(job->filename, &fsize, &ftype, NULL) != 0) {
+#endif
+					continue;
+				}
+				if(ftype == S_IFREG) total += fsize;
+			}
+			if(minibar_open(stderr, opt_workers + 1) < 0) {
 				fprintf(stderr, PREFIX "minibar init failed.\n");
 				abort();
 			}
-			/* create visualizer */
-			running = 1;
-			if((err = pthread_create(&tid, NULL, visualizer, NULL)) != 0) {
-				fprintf(stderr, PREFIX "create visualizer thread failed (%d): %s\n",
+			if((err = progress_start(&progress, opt_workers, total, opt_progress_interval)) != 0) {
+				fprintf(stderr, PREFIX "create progress thread failed (%d): %s\n",
 					err, herrmsg(msg, sizeof(msg), err));
 				abort();
 			}
@@ -772,9 +1323,24 @@ main(int argc, char *argv[]) {
 				err, herrmsg(msg, sizeof(msg), err));
 			abort();
 		}
+		/* jobs are claimed in dispatch order, except the deferred ones of
+		 * --per-device-workers, and printed in input order. a window of
+		 * all jobs (--schedule needs them up front) never waits, and costs
+		 * a byte per job that is in memory anyway. streamed jobs use a
+		 * fixed window, the job store stays bounded until it is flushed */
+		if(opt_np && opt_unordered == 0
+		&& reorder_init(&output, producers > 0 ? REORDER_WINDOW : jobs.count, output_job, NULL) < 0) {
+			fprintf(stderr, PREFIX "FATAL: output init failed.\n");
+			exit(-1);
+		}
 		/* run workers */
+		active = opt_workers;
+		hashopt.split = (opt_workers > 1);
+		/* workers gather small files, progress bars show one job per worker */
+		if(opt_np && hashopt.direct == 0 && opt_multibuf != MBHASH_OFF)
+			hashopt.multibuf = opt_multibuf == MBHASH_ON || mbhash_auto();
 		for(i = 0; i < opt_workers; i++) {
-			if((err = pthread_create(&tid, NULL, worker, NULL)) != 0) {
+			if((err = pthread_create(&tid, NULL, worker, (void *) (size_t) i)) != 0) {
 				fprintf(stderr, PREFIX "create worker thread failed (%d): %s\n",
 					err, herrmsg(msg, sizeof(msg), err));
 				abort();
@@ -783,25 +1349,63 @@ main(int argc, char *argv[]) {
 		}
 		/* wait for workers */
 		pthread_barrier_wait(&barrier);
-		running = 0;
 
 		if(opt_np == 0) {
+			progress_stop(&progress);
 			minibar_close();
 		}
 	}
+	ATOMIC_ADD(&hash_err, walk_errors() + listfile_errors());
+	check_linerror += load_checks_errors();
+#ifndef _WIN32
+	if(hashopt.cache != NULL && (err = cache_close(hashopt.cache)) != 0) {
+		fprintf(stderr, PREFIX "%s: save cache failed (%d): %s\n", opt_cache,
+			err, herrmsg(msg, sizeof(msg), err));
+	}
+	hashopt.cache = NULL;
+#endif
 
 	if(opt_check == 0) {
 		if(opt_one == 0 && opt_np == 0)
-			print_digest(njobs, jobs);
+			print_digest(&jobs);
 	} else {
 		if(opt_one == 0 && opt_np == 0)
-			print_check(njobs, jobs);
+			print_check(&jobs);
+	}
+	writer_stop(&wout);
+	writer_stop(&werr);
+	if(hashopt.stats != NULL) {
+		if(opt_stats)
+			stats_report(hashopt.stats, stderr);
+		if((err = stats_close(hashopt.stats)) != 0) {
+			fprintf(stderr, PREFIX "%s: write failed (%d): %s\n",
+#ifdef _WIN32
+				wchar2utf8_static(opt_stats_json),
+#else
+				opt_stats_json,
+#endif
+				err, herrmsg(msg, sizeof(msg), err));
+		}
+		hashopt.stats = NULL;
 	}
 
-	if(jobs != NULL) {
-		free(jobs);
-		jobs = NULL;
+	jobstore_free(&jobs);
+	if(roots != NULL) {
+		free(roots);
+		roots = NULL;
+	}
+	if(order != NULL) {
+		free(order);
+		order = NULL;
+	}
+	if(devs != NULL) {
+		free(devs);
+		devs = NULL;
 	}
+	dispatch_free(&dispatcher);
+	reorder_free(&output);
+	bufpool_release();
+	hash_release();
 
 	return return_value();
 }
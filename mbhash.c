@@ -0,0 +1,234 @@
+#include <string.h>
+#include <stdint.h>
+#include "mbhash.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define	MBHASH_AVX2
+#define	AVX2_TARGET	__attribute__((target("avx2")))
+#include <cpuid.h>
+#include <immintrin.h>
+#elif defined(_M_X64)
+#define	MBHASH_AVX2
+#define	AVX2_TARGET
+#include <intrin.h>
+#include <immintrin.h>
+#endif
+
+static const uint32_t K[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static const uint32_t IV[8] = {
+	0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
+typedef void (*compress_t)(uint32_t st[8][MBHASH_LANES], const unsigned char **blk);
+
+static uint32_t
+be32(const unsigned char *p) {
+	return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) | ((uint32_t) p[2] << 8) | p[3];
+}
+
+#define	ROR(x, n)	(((x) >> (n)) | ((x) << (32 - (n))))
+
+static void	/* one block of each lane, a lane at a time */
+compress_portable(uint32_t st[8][MBHASH_LANES], const unsigned char **blk) {
+	uint32_t w[64], a, b, c, d, e, f, g, h, t1, t2;
+	int i, t;
+	for(i = 0; i < MBHASH_LANES; i++) {
+		for(t = 0; t < 16; t++)
+			w[t] = be32(blk[i] + 4 * t);
+		for(t = 16; t < 64; t++)
+			w[t] = (ROR(w[t-2], 17) ^ ROR(w[t-2], 19) ^ (w[t-2] >> 10)) + w[t-7]
+				+ (ROR(w[t-15], 7) ^ ROR(w[t-15], 18) ^ (w[t-15] >> 3)) + w[t-16];
+		a = st[0][i]; b = st[1][i]; c = st[2][i]; d = st[3][i];
+		e = st[4][i]; f = st[5][i]; g = st[6][i]; h = st[7][i];
+		for(t = 0; t < 64; t++) {
+			t1 = h + (ROR(e, 6) ^ ROR(e, 11) ^ ROR(e, 25)) + ((e & f) ^ (~e & g)) + K[t] + w[t];
+			t2 = (ROR(a, 2) ^ ROR(a, 13) ^ ROR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+			h = g; g = f; f = e; e = d + t1;
+			d = c; c = b; b = a; a = t1 + t2;
+		}
+		st[0][i] += a; st[1][i] += b; st[2][i] += c; st[3][i] += d;
+		st[4][i] += e; st[5][i] += f; st[6][i] += g; st[7][i] += h;
+	}
+}
+
+#ifdef MBHASH_AVX2
+#define	V_ADD(x, y)	_mm256_add_epi32((x), (y))
+#define	V_XOR(x, y)	_mm256_xor_si256((x), (y))
+#define	V_ROR(x, n)	_mm256_or_si256(_mm256_srli_epi32((x), (n)), _mm256_slli_epi32((x), 32 - (n)))
+#define	V_SHR(x, n)	_mm256_srli_epi32((x), (n))
+
+static AVX2_TARGET void	/* one block of each lane, all 8 lanes at once */
+compress_avx2(uint32_t st[8][MBHASH_LANES], const unsigned char **blk) {
+	__m256i w[16], a, b, c, d, e, f, g, h, t1, t2, s0, s1;
+	int t;
+	for(t = 0; t < 16; t++)
+		w[t] = _mm256_set_epi32(be32(blk[7] + 4*t), be32(blk[6] + 4*t), be32(blk[5] + 4*t), be32(blk[4] + 4*t),
+			be32(blk[3] + 4*t), be32(blk[2] + 4*t), be32(blk[1] + 4*t), be32(blk[0] + 4*t));
+	a = _mm256_loadu_si256((const __m256i *) st[0]);
+	b = _mm256_loadu_si256((const __m256i *) st[1]);
+	c = _mm256_loadu_si256((const __m256i *) st[2]);
+	d = _mm256_loadu_si256((const __m256i *) st[3]);
+	e = _mm256_loadu_si256((const __m256i *) st[4]);
+	f = _mm256_loadu_si256((const __m256i *) st[5]);
+	g = _mm256_loadu_si256((const __m256i *) st[6]);
+	h = _mm256_loadu_si256((const __m256i *) st[7]);
+	for(t = 0; t < 64; t++) {
+		if(t >= 16) {	/* the message schedule in a ring of 16 */
+			s0 = w[(t-15) & 15];
+			s0 = V_XOR(V_XOR(V_ROR(s0, 7), V_ROR(s0, 18)), V_SHR(s0, 3));
+			s1 = w[(t-2) & 15];
+			s1 = V_XOR(V_XOR(V_ROR(s1, 17), V_ROR(s1, 19)), V_SHR(s1, 10));
+			w[t & 15] = V_ADD(V_ADD(w[t & 15], s0), V_ADD(w[(t-7) & 15], s1));
+		}
+		t1 = V_ADD(V_ADD(h, V_XOR(V_XOR(V_ROR(e, 6), V_ROR(e, 11)), V_ROR(e, 25))),
+			V_ADD(V_XOR(_mm256_and_si256(e, f), _mm256_andnot_si256(e, g)),
+			V_ADD(_mm256_set1_epi32((int) K[t]), w[t & 15])));
+		t2 = V_ADD(V_XOR(V_XOR(V_ROR(a, 2), V_ROR(a, 13)), V_ROR(a, 22)),
+			V_XOR(V_XOR(_mm256_and_si256(a, b), _mm256_and_si256(a, c)), _mm256_and_si256(b, c)));
+		h = g; g = f; f = e; e = V_ADD(d, t1);
+		d = c; c = b; b = a; a = V_ADD(t1, t2);
+	}
+	_mm256_storeu_si256((__m256i *) st[0], V_ADD(a, _mm256_loadu_si256((const __m256i *) st[0])));
+	_mm256_storeu_si256((__m256i *) st[1], V_ADD(b, _mm256_loadu_si256((const __m256i *) st[1])));
+	_mm256_storeu_si256((__m256i *) st[2], V_ADD(c, _mm256_loadu_si256((const __m256i *) st[2])));
+	_mm256_storeu_si256((__m256i *) st[3], V_ADD(d, _mm256_loadu_si256((const __m256i *) st[3])));
+	_mm256_storeu_si256((__m256i *) st[4], V_ADD(e, _mm256_loadu_si256((const __m256i *) st[4])));
+	_mm256_storeu_si256((__m256i *) st[5], V_ADD(f, _mm256_loadu_si256((const __m256i *) st[5])));
+	_mm256_storeu_si256((__m256i *) st[6], V_ADD(g, _mm256_loadu_si256((const __m256i *) st[6])));
+	_mm256_storeu_si256((__m256i *) st[7], V_ADD(h, _mm256_loadu_si256((const __m256i *) st[7])));
+}
+
+static void
+cpuid(unsigned int leaf, unsigned int sub, unsigned int r[4]) {
+#ifdef _MSC_VER
+	__cpuidex((int *) r, leaf, sub);
+#else
+	__cpuid_count(leaf, sub, r[0], r[1], r[2], r[3]);
+#endif
+}
+
+static int	/* 1: avx2, 2: avx2 and sha extensions */
+cpu_avx2() {
+	static volatile int cached = -1;
+	unsigned int r1[4] = { 0 }, r7[4] = { 0 };
+	unsigned long long xcr0 = 0;
+	int avx2;
+	if(cached >= 0)
+		return cached;
+	cpuid(0, 0, r1);
+	if(r1[0] >= 7) cpuid(7, 0, r7);
+	cpuid(1, 0, r1);
+	if(r1[2] & (1u<<27)) {	/* osxsave */
+#ifdef _MSC_VER
+		xcr0 = _xgetbv(0);
+#else
+		unsigned int lo, hi;
+		__asm__ volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+		xcr0 = ((unsigned long long) hi << 32) | lo;
+#endif
+	}
+	avx2 = ((r7[1] >> 5) & 1) && (xcr0 & 0x6) == 0x6;
+	cached = avx2 ? 1 + ((r7[1] >> 29) & 1) : 0;
+	return cached;
+}
+#endif
+
+const char *	/* the lane code mbhash_sha256() runs */
+mbhash_simd() {
+#ifdef MBHASH_AVX2
+	if(cpu_avx2()) return "avx2";
+#endif
+	return "portable";
+}
+
+int	/* 1 if gathering small files pays off on this cpu */
+mbhash_auto() {
+#ifdef MBHASH_AVX2
+	/* one sha-ni stream in openssl is faster than 8 avx2 lanes */
+	return cpu_avx2() == 1;
+#else
+	return 0;
+#endif
+}
+
+typedef struct lane_s {
+	int msg;	/* -1 if idle */
+	size_t block, nblocks, nfull;	/* next block, all blocks, blocks read from the message */
+	unsigned char tail[128];	/* the rest of the message, padded */
+}	lane_t;
+
+static void	/* start message m in lane i */
+lane_start(lane_t *ln, uint32_t st[8][MBHASH_LANES], int i, int m, size_t len, const unsigned char *msg) {
+	unsigned long long bits = (unsigned long long) len << 3;
+	size_t rest = len & 63, ntail = rest + 9 > 64 ? 2 : 1;
+	int k;
+	ln->msg = m;
+	ln->block = 0;
+	ln->nfull = len >> 6;
+	ln->nblocks = ln->nfull + ntail;
+	memset(ln->tail, 0, sizeof(ln->tail));
+	memcpy(ln->tail, msg + (len - rest), rest);
+	ln->tail[rest] = 0x80;
+	for(k = 0; k < 8; k++)
+		ln->tail[ntail * 64 - 1 - k] = (unsigned char) (bits >> (8 * k));
+	for(k = 0; k < 8; k++)
+		st[k][i] = IV[k];
+}
+
+void	/* digests of n messages, identical to sha-256 of each */
+mbhash_sha256(const unsigned char **msg, const size_t *len, int n, unsigned char (*digest)[32]) {
+	static const unsigned char idle[64] = { 0 };
+	uint32_t st[8][MBHASH_LANES];
+	lane_t lanes[MBHASH_LANES];
+	const unsigned char *blk[MBHASH_LANES];
+	compress_t compress = compress_portable;
+	int i, k, next = 0, active = 0;
+#ifdef MBHASH_AVX2
+	if(cpu_avx2()) compress = compress_avx2;
+#endif
+	for(i = 0; i < MBHASH_LANES; i++) {
+		lanes[i].msg = -1;
+		if(next < n) {
+			lane_start(&lanes[i], st, i, next, len[next], msg[next]);
+			next++;
+			active++;
+		}
+	}
+	while(active > 0) {
+		for(i = 0; i < MBHASH_LANES; i++) {
+			lane_t *ln = &lanes[i];
+			if(ln->msg < 0) {
+				blk[i] = idle;	/* hashed for nothing, its state is never read */
+			} else if(ln->block < ln->nfull) {
+				blk[i] = msg[ln->msg] + 64 * ln->block;
+			} else {
+				blk[i] = ln->tail + 64 * (ln->block - ln->nfull);
+			}
+		}
+		compress(st, blk);
+		for(i = 0; i < MBHASH_LANES; i++) {
+			lane_t *ln = &lanes[i];
+			if(ln->msg < 0 || ++ln->block < ln->nblocks)
+				continue;
+			for(k = 0; k < 32; k++)
+				digest[ln->msg][k] = (unsigned char) (st[k >> 2][i] >> (24 - 8 * (k & 3)));
+			ln->msg = -1;
+			if(next < n) {
+				lane_start(ln, st, i, next, len[next], msg[next]);
+				next++;
+			} else {
+				active--;
+			}
+		}
+	}
+}
@@ -0,0 +1,25 @@
+#ifndef __MBHASH_H__
+#define __MBHASH_H__
+
+/* multi-buffer sha-256: several independent messages are hashed side by
+ * side, one per 32-bit lane of a simd register. a lane that finishes its
+ * message takes the next one, so messages of different lengths keep all
+ * the lanes busy. avx2 runs 8 lanes, other cpus a portable loop */
+
+#include <stddef.h>
+
+#define	MBHASH_LANES	8
+#define	MBHASH_JOBS	16	/* small files a worker gathers before hashing them */
+#define	MBHASH_MAX	(64<<10)	/* larger files are hashed one by one */
+
+enum {	// --multi-buffer
+	MBHASH_OFF = 0,
+	MBHASH_ON,
+	MBHASH_AUTO,	// on if the cpu has avx2 but no sha extensions
+};
+
+const char * mbhash_simd();
+int  mbhash_auto();
+void mbhash_sha256(const unsigned char **msg, const size_t *len, int n, unsigned char (*digest)[32]);
+
+#endif	/* __MBHASH_H__ */
@@ -0,0 +1,156 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+#include "hashsumr.h"
+#include "progress.h"
+#include "stats.h"
+
+static void
+nap(int ms) {
+#ifdef _WIN32
+	Sleep(ms);
+#else
+	usleep(ms * 1000);
+#endif
+}
+
+static void	/* 1234567 -> "1.23 M" + suffix */
+human(char *buf, size_t sz, double v, const char *suffix) {
+	static const char *units[] = { "", "K", "M", "G", "T", "P" };
+	int u = 0;
+	while(v >= 1000 && u < 5) {
+		v /= 1000;
+		u++;
+	}
+	snprintf(buf, sz, "%.*f %s%s", u ? 2 : 0, v, units[u], suffix);
+}
+
+static void	/* read the counters of all workers, update the bars */
+sample(progress_t *p) {
+	unsigned long long bytes = 0, t = stats_now(), remain;
+	char sdone[32], stotal[32], srate[32], eta[32];
+	double dt;
+	int i;
+	for(i = 0; i < p->nslots; i++) {
+		pslot_t *s = &p->slots[i];
+		bytes += ATOMIC_LOAD(&s->done);
+		pthread_mutex_lock(&s->mutex);
+		if(s->job != NULL) {
+			unsigned long long checked = ATOMIC_LOAD(&s->job->checked);
+			unsigned long long filesz = s->job->filesz;
+			bytes += checked;
+			if(s->bar != NULL && filesz != HASHSUMR_SIZE_UNKNOWN && filesz > 0)
+				minibar_setvalue(s->bar, checked >= filesz ? 100.0 : checked * 100.0 / filesz);
+		}
+		pthread_mutex_unlock(&s->mutex);
+	}
+	/* exponential moving average of the rate */
+	dt = (t - p->tlast) / 1e9;
+	if(dt > 0 && bytes >= p->blast) {
+		double inst = (bytes - p->blast) / dt;
+		double alpha = dt * 1000 / PROGRESS_RATE_WINDOW;
+		if(p->tlast == p->t0 || alpha > 1) alpha = 1;
+		p->rate += alpha * (inst - p->rate);
+	}
+	p->tlast = t;
+	p->blast = bytes;
+
+	human(sdone, sizeof(sdone), (double) bytes, "B");
+	human(srate, sizeof(srate), p->rate, "B/s");
+	if(p->total == 0) {
+		snprintf(p->title, sizeof(p->title), "total %s, %s", sdone, srate);
+		return;
+	}
+	remain = p->total > bytes ? p->total - bytes : 0;
+	if(p->rate >= 1) {
+		unsigned long long s = (unsigned long long) (remain / p->rate);
+		snprintf(eta, sizeof(eta), "%llu:%02llu:%02llu", s / 3600, s / 60 % 60, s % 60);
+	} else {
+		snprintf(eta, sizeof(eta), "-:--:--");
+	}
+	human(stotal, sizeof(stotal), (double) p->total, "B");
+	snprintf(p->title, sizeof(p->title), "total %s of %s, %s, ETA %s", sdone, stotal, srate, eta);
+	if(p->bar != NULL)
+		minibar_setvalue(p->bar, bytes >= p->total ? 100.0 : bytes * 100.0 / p->total);
+}
+
+static void *
+renderer(void *arg) {
+	progress_t *p = (progress_t *) arg;
+	int waited;
+	while(p->running) {
+		/* short naps, so stopping does not wait for a whole interval */
+		for(waited = 0; waited < p->interval && p->running; waited += 50)
+			nap(p->interval - waited < 50 ? p->interval - waited : 50);
+		sample(p);
+		minibar_refresh();
+	}
+	return NULL;
+}
+
+int	/* after minibar_open() with a bar more than workers, 0 or errno */
+progress_start(progress_t *p, int nworkers, unsigned long long total, int interval) {
+	int i, err;
+	memset(p, 0, sizeof(progress_t));
+	if((p->slots = (pslot_t *) calloc(nworkers, sizeof(pslot_t))) == NULL)
+		return ENOMEM;
+	for(i = 0; i < nworkers; i++)
+		pthread_mutex_init(&p->slots[i].mutex, NULL);
+	p->nslots = nworkers;
+	p->total = total;
+	p->interval = interval > 0 ? interval : PROGRESS_INTERVAL;
+	p->t0 = p->tlast = stats_now();
+	snprintf(p->title, sizeof(p->title), "total");
+	p->bar = minibar_get(p->title);	/* minibar draws the title from our buffer */
+	p->running = 1;
+	if((err = pthread_create(&p->tid, NULL, renderer, p)) != 0) {
+		p->running = 0;
+		return err;
+	}
+	return 0;
+}
+
+void	/* a worker starts a job */
+progress_begin(progress_t *p, int id, job_t *job, minibar_t *bar) {
+	pslot_t *s = &p->slots[id];
+	pthread_mutex_lock(&s->mutex);
+	s->job = job;
+	s->bar = bar;
+	pthread_mutex_unlock(&s->mutex);
+}
+
+minibar_t *	/* a worker finished its job, returns the bar of the job */
+progress_end(progress_t *p, int id) {
+	pslot_t *s = &p->slots[id];
+	minibar_t *bar;
+	pthread_mutex_lock(&s->mutex);
+	if(s->job != NULL)
+		ATOMIC_STORE(&s->done, s->done + s->job->checked);
+	bar = s->bar;
+	s->job = NULL;
+	s->bar = NULL;
+	pthread_mutex_unlock(&s->mutex);
+	return bar;
+}
+
+void	/* join the renderer and draw the final numbers */
+progress_stop(progress_t *p) {
+	int i;
+	if(p->slots == NULL)
+		return;
+	if(p->running) {
+		p->running = 0;
+		pthread_join(p->tid, NULL);
+	}
+	sample(p);
+	if(p->bar != NULL)
+		minibar_complete(p->bar);
+	minibar_refresh();
+	for(i = 0; i < p->nslots; i++)
+		pthread_mutex_destroy(&p->slots[i].mutex);
+	free(p->slots);
+	p->slots = NULL;
+}
@@ -0,0 +1,41 @@
+#ifndef __PROGRESS_H__
+#define __PROGRESS_H__
+
+/* progress bars for -p: workers only publish the job they run and count
+ * the bytes of finished jobs, a renderer thread samples job->checked at
+ * a fixed rate, so hashing never calls into the bars. an overall bar
+ * shows the bytes done of the total, the current rate, and the ETA */
+
+#include "hashsumr.h"
+#include "minibar/minibar.h"
+
+#define	PROGRESS_INTERVAL	250	/* ms between two samples */
+#define	PROGRESS_RATE_WINDOW	3000	/* ms, the rate is averaged over about this long */
+
+typedef struct pslot_s {	/* per worker, on cache lines of its own */
+	pthread_mutex_t mutex;	/* job and bar change under it */
+	job_t *job;	/* running, or NULL */
+	minibar_t *bar;
+	volatile unsigned long long done;	/* bytes of finished jobs */
+	char pad[64];
+}	pslot_t;
+
+typedef struct progress_s {
+	pslot_t *slots;
+	int nslots;
+	unsigned long long total;	/* bytes of all the files, 0 if unknown */
+	int interval;	/* ms */
+	volatile int running;
+	pthread_t tid;
+	minibar_t *bar;	/* overall */
+	char title[192];	/* of the overall bar, rewritten by each sample */
+	unsigned long long t0, tlast, blast;	/* start, last sample: time, bytes */
+	double rate;	/* bytes per second, smoothed */
+}	progress_t;
+
+int  progress_start(progress_t *p, int nworkers, unsigned long long total, int interval);
+void progress_begin(progress_t *p, int id, job_t *job, minibar_t *bar);
+minibar_t * progress_end(progress_t *p, int id);
+void progress_stop(progress_t *p);
+
+#endif	/* __PROGRESS_H__ */
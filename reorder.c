@@ -0,0 +1,47 @@
+#include <stdlib.h>
+#include <string.h>
+#include "hashsumr.h"
+#include "reorder.h"
+
+int
+reorder_init(reorder_t *r, int size, reorder_emit_t emit, void *arg) {
+	memset(r, 0, sizeof(reorder_t));
+	if(size < 1) size = 1;
+	if((r->done = (unsigned char *) calloc(size, 1)) == NULL)
+		return -1;
+	r->size = size;
+	r->emit = emit;
+	r->arg = arg;
+	pthread_mutex_init(&r->mutex, NULL);
+	pthread_cond_init(&r->cond, NULL);
+	return 0;
+}
+
+void	/* job pos is finished. jobs must be started in order, or waiting
+	 * for the window may never end */
+reorder_done(reorder_t *r, int pos) {
+	int start;
+	pthread_mutex_lock(&r->mutex);
+	while(pos - r->next >= r->size)
+		pthread_cond_wait(&r->cond, &r->mutex);
+	r->done[pos % r->size] = 1;
+	start = r->next;
+	while(r->done[r->next % r->size]) {
+		r->done[r->next % r->size] = 0;
+		r->emit(r->next, r->arg);
+		r->next++;
+	}
+	if(r->next != start)
+		pthread_cond_broadcast(&r->cond);
+	pthread_mutex_unlock(&r->mutex);
+}
+
+void
+reorder_free(reorder_t *r) {
+	if(r->done == NULL)
+		return;
+	free(r->done);
+	r->done = NULL;
+	pthread_mutex_destroy(&r->mutex);
+	pthread_cond_destroy(&r->cond);
+}
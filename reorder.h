@@ -0,0 +1,30 @@
+#ifndef __REORDER_H__
+#define __REORDER_H__
+
+/* in-order output stage: workers report jobs as they finish, and each
+ * contiguous run of finished jobs is emitted in job order. a worker
+ * that gets ahead of the oldest unfinished job by the window size
+ * waits, so the state stays bounded by the window */
+
+#include "hashsumr.h"
+
+#define	REORDER_WINDOW	4096	/* jobs that may finish ahead of the oldest unfinished one */
+
+/* called in job order with the window lock held */
+typedef void (*reorder_emit_t)(int pos, void *arg);
+
+typedef struct reorder_s {
+	unsigned char *done;	/* ring of size slots */
+	int size;
+	int next;	/* oldest job not emitted yet */
+	reorder_emit_t emit;
+	void *arg;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+}	reorder_t;
+
+int  reorder_init(reorder_t *r, int size, reorder_emit_t emit, void *arg);
+void reorder_done(reorder_t *r, int pos);
+void reorder_free(reorder_t *r);
+
+#endif	/* __REORDER_H__ */
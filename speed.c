@@ -0,0 +1,300 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "hashsumr.h"
+#include "speed.h"
+#include "stats.h"
+#include "mbhash.h"
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define	SPEED_X86
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#include <x86intrin.h>
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define	SPEED_ARM64
+#if defined(__linux__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#elif defined(__APPLE__)
+#include <sys/sysctl.h>
+#endif
+#endif
+
+#ifndef _WIN32
+#include <openssl/crypto.h>
+#endif
+
+static const size_t sizes[] = { 64, 1024, 16384, SPEED_MAXSIZE };
+#define	NSIZES	(sizeof(sizes) / sizeof(sizes[0]))
+
+typedef struct run_s {
+	md_t *md;
+	size_t size;
+	unsigned char *buf;
+	unsigned long long bytes, ns, ticks;
+	int err;
+}	run_t;
+
+static unsigned long long	/* time stamp counter, 0 if there is none */
+ticks() {
+#ifdef SPEED_X86
+	return __rdtsc();
+#else
+	return 0;
+#endif
+}
+
+/* the cpu features behind the simd code of openssl and blake3.
+ * blake3 picks the widest of avx512, avx2, sse4.1, and sse2 (neon on
+ * arm64) at run time; openssl uses the sha extensions if the cpu has
+ * them, unless OPENSSL_ia32cap (OPENSSL_armcap) masks them */
+
+#ifdef SPEED_X86
+static void
+cpuid(unsigned int leaf, unsigned int sub, unsigned int r[4]) {
+#ifdef _MSC_VER
+	__cpuidex((int *) r, leaf, sub);
+#else
+	__cpuid_count(leaf, sub, r[0], r[1], r[2], r[3]);
+#endif
+}
+
+static unsigned long long	/* register states saved by the os */
+xgetbv0() {
+#ifdef _MSC_VER
+	return _xgetbv(0);
+#else
+	unsigned int a, d;
+	__asm__ volatile("xgetbv" : "=a"(a), "=d"(d) : "c"(0));
+	return ((unsigned long long) d << 32) | a;
+#endif
+}
+#endif
+
+static void
+cpu_features(char *flags, size_t sz, const char **simd, const char **shaext) {
+	flags[0] = '\0';
+	*simd = "portable";
+	*shaext = NULL;
+#if defined(SPEED_X86)
+	{
+		unsigned int r1[4] = { 0 }, r7[4] = { 0 };
+		unsigned long long xcr0 = 0;
+		int sse2, sse41, avx2, avx512, sha;
+		cpuid(0, 0, r1);
+		if(r1[0] >= 7) cpuid(7, 0, r7);
+		cpuid(1, 0, r1);
+		if(r1[2] & (1u<<27)) xcr0 = xgetbv0();	/* osxsave */
+		sse2 = (r1[3] >> 26) & 1;
+		sse41 = (r1[2] >> 19) & 1;
+		avx2 = ((r7[1] >> 5) & 1) && (xcr0 & 0x6) == 0x6;
+		avx512 = ((r7[1] >> 16) & 1) && ((r7[1] >> 31) & 1) && (xcr0 & 0xe6) == 0xe6;	/* f + vl */
+		sha = (r7[1] >> 29) & 1;
+		snprintf(flags, sz, "%s%s%s%s%s", sse2 ? " sse2" : "", sse41 ? " sse4.1" : "",
+			avx2 ? " avx2" : "", avx512 ? " avx512" : "", sha ? " sha-ni" : "");
+		*simd = avx512 ? "avx512" : avx2 ? "avx2" : sse41 ? "sse4.1" : sse2 ? "sse2" : "portable";
+		*shaext = sha ? "sha-ni" : NULL;
+	}
+#elif defined(SPEED_ARM64)
+	{
+		int sha2 = 0, sha512 = 0, sha3 = 0;
+#if defined(__linux__)
+		unsigned long hw = getauxval(AT_HWCAP);
+		sha2 = (hw & HWCAP_SHA2) != 0;
+#ifdef HWCAP_SHA512
+		sha512 = (hw & HWCAP_SHA512) != 0;
+#endif
+#ifdef HWCAP_SHA3
+		sha3 = (hw & HWCAP_SHA3) != 0;
+#endif
+#elif defined(__APPLE__)
+		int v = 0;
+		size_t len = sizeof(v);
+		sha2 = 1;	/* all apple silicon */
+		if(sysctlbyname("hw.optional.armv8_2_sha512", &v, &len, NULL, 0) == 0) sha512 = v;
+		len = sizeof(v);
+		if(sysctlbyname("hw.optional.armv8_2_sha3", &v, &len, NULL, 0) == 0) sha3 = v;
+#elif defined(_WIN32)
+		sha2 = IsProcessorFeaturePresent(PF_ARM_V8_CRYPTO_INSTRUCTIONS_AVAILABLE) != 0;
+#endif
+		snprintf(flags, sz, " neon%s%s%s", sha2 ? " sha2" : "", sha512 ? " sha512" : "", sha3 ? " sha3" : "");
+		*simd = "neon";
+		*shaext = sha2 ? "armv8 sha2" : NULL;
+	}
+#endif
+	if(flags[0] == '\0') snprintf(flags, sz, " (unknown)");
+}
+
+static void *
+speed_thread(void *arg) {
+	run_t *r = (run_t *) arg;
+	ctx_t *ctx;
+	unsigned char h[EVP_MAX_MD_SIZE];
+	unsigned int hlen;
+	unsigned long long t0, t1, c0, n = 0;
+	int i, batch = r->size >= 65536 ? 1 : 16;	/* messages between two clock reads */
+	if((ctx = r->md->fnew()) == NULL) {
+		r->err = 1;
+		return NULL;
+	}
+	t0 = stats_now();
+	c0 = ticks();
+	do {
+		for(i = 0; i < batch; i++) {
+			hlen = sizeof(h);
+			if(r->md->finit(ctx, r->md->arginit) != 1
+			|| r->md->fupdate(ctx, r->buf, r->size) != 1
+			|| r->md->ffinal(ctx, h, &hlen) != 1) {
+				r->err = 1;
+				goto done;
+			}
+		}
+		n += batch;
+		t1 = stats_now();
+	} while(t1 - t0 < SPEED_MSEC * 1000000ULL);
+	r->ticks = ticks() - c0;
+	r->ns = t1 - t0;
+	r->bytes = n * r->size;
+done:
+	r->md->ffree(ctx);
+	return NULL;
+}
+
+static int	/* hash size bytes with n threads, prints a result line */
+speed1(md_t *md, size_t size, run_t *runs, int n) {
+	pthread_t *tids;
+	double mbps = 0, bytes = 0, nticks = 0;
+	int i, started = 0, err = 0;
+	if((tids = (pthread_t *) calloc(n, sizeof(pthread_t))) == NULL)
+		return -1;
+	for(i = 0; i < n; i++) {
+		runs[i].md = md;
+		runs[i].size = size;
+		runs[i].bytes = runs[i].ns = runs[i].ticks = 0;
+		runs[i].err = 0;
+	}
+	if(n == 1) {
+		speed_thread(&runs[0]);
+		started = 1;
+	} else {
+		for(started = 0; started < n; started++) {
+			if(pthread_create(&tids[started], NULL, speed_thread, &runs[started]) != 0)
+				break;
+		}
+		for(i = 0; i < started; i++)
+			pthread_join(tids[i], NULL);
+	}
+	free(tids);
+	for(i = 0; i < started; i++) {
+		if(runs[i].err || runs[i].ns == 0) {
+			err = 1;
+			continue;
+		}
+		mbps += runs[i].bytes / (runs[i].ns / 1e9) / 1e6;
+		bytes += runs[i].bytes;
+		nticks += runs[i].ticks;
+	}
+	if(err || started == 0) {
+		printf("%-12s %8lu %8d %10s %9s\n", md->name, (unsigned long) size, n, "failed", "-");
+		return -1;
+	}
+	/* per core, tsc ticks run at the nominal frequency */
+	if(nticks > 0)
+		printf("%-12s %8lu %8d %10.1f %9.2f\n", md->name, (unsigned long) size, started, mbps, nticks / bytes);
+	else
+		printf("%-12s %8lu %8d %10.1f %9s\n", md->name, (unsigned long) size, started, mbps, "-");
+	fflush(stdout);
+	return 0;
+}
+
+static void	/* sha-256 of MBHASH_JOBS messages per call, as --multi-buffer hashes small files */
+speed_mb(size_t size, const unsigned char *buf) {
+	const unsigned char *msg[MBHASH_JOBS];
+	size_t len[MBHASH_JOBS];
+	unsigned char h[MBHASH_JOBS][32];
+	unsigned long long t0, t1, c0, c1, n = 0;
+	int i;
+	for(i = 0; i < MBHASH_JOBS; i++) {
+		msg[i] = buf;
+		len[i] = size;
+	}
+	t0 = stats_now();
+	c0 = ticks();
+	do {
+		mbhash_sha256(msg, len, MBHASH_JOBS, h);
+		n += MBHASH_JOBS;
+		t1 = stats_now();
+	} while(t1 - t0 < SPEED_MSEC * 1000000ULL);
+	c1 = ticks();
+	if(c0 != 0)
+		printf("%-12s %8lu %8d %10.1f %9.2f\n", "SHA256/mb", (unsigned long) size, 1,
+			n * size / ((t1 - t0) / 1e9) / 1e6, (c1 - c0) / (double) (n * size));
+	else
+		printf("%-12s %8lu %8d %10.1f %9s\n", "SHA256/mb", (unsigned long) size, 1,
+			n * size / ((t1 - t0) / 1e9) / 1e6, "-");
+	fflush(stdout);
+}
+
+int	/* 0, or -1 if any measurement failed */
+speed_run(md_t **algs, int nalgs, int nthreads) {
+	run_t *runs;
+	char flags[128];
+	const char *simd, *shaext;
+	unsigned long long t0, c0;
+	int i, j, err = 0;
+	if(nthreads < 1) nthreads = 1;
+	if((runs = (run_t *) calloc(nthreads, sizeof(run_t))) == NULL)
+		return -1;
+	for(i = 0; i < nthreads; i++) {
+		if((runs[i].buf = (unsigned char *) malloc(SPEED_MAXSIZE)) == NULL) {
+			err = -1;
+			goto done;
+		}
+		for(j = 0; j < SPEED_MAXSIZE; j++)
+			runs[i].buf[j] = (unsigned char) (j * 131 + i);
+	}
+
+	cpu_features(flags, sizeof(flags), &simd, &shaext);
+	t0 = stats_now();
+	c0 = ticks();
+	while(stats_now() - t0 < 20000000ULL)
+		;
+	printf("cpu:%s", flags);
+	if(c0 != 0)
+		printf("; tsc %.2f GHz", (ticks() - c0) / (double) (stats_now() - t0));
+	printf("\n");
+#ifdef _WIN32
+	printf("sha-2: CNG (bcrypt), sha extensions %s\n", shaext ? shaext : "not available");
+#else
+	printf("sha-2: %s, sha extensions %s%s\n", OpenSSL_version(OPENSSL_VERSION),
+		shaext ? shaext : "not available",
+		shaext && (getenv("OPENSSL_ia32cap") || getenv("OPENSSL_armcap")) ? " (masked by the environment?)" : "");
+#endif
+	printf("blake3: %s, %s\n", blake3_version(), simd);
+	printf("multi-buffer: sha-256 in %d %s lanes, %s by default\n", MBHASH_LANES, mbhash_simd(),
+		mbhash_auto() ? "on" : "off");
+	printf("\n%-12s %8s %8s %10s %9s\n", "algorithm", "size", "threads", "MB/s", "cycles/B");
+	fflush(stdout);
+
+	for(i = 0; i < nalgs; i++) {
+		for(j = 0; j < (int) NSIZES; j++) {
+			if(speed1(algs[i], sizes[j], runs, 1) != 0)
+				err = -1;
+			if(nthreads > 1 && speed1(algs[i], sizes[j], runs, nthreads) != 0)
+				err = -1;
+		}
+		if(strcmp(algs[i]->name, "SHA256") == 0) {
+			for(j = 0; j < (int) NSIZES && sizes[j] <= MBHASH_MAX; j++)
+				speed_mb(sizes[j], runs[0].buf);
+		}
+	}
+done:
+	for(i = 0; i < nthreads; i++)
+		free(runs[i].buf);
+	free(runs);
+	return err;
+}
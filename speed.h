@@ -0,0 +1,16 @@
+#ifndef __SPEED_H__
+#define __SPEED_H__
+
+/* algorithm throughput on in-memory buffers (--benchmark): every size is
+ * hashed as whole messages (init, update, final) for a fixed time, by
+ * one thread and by several. the cpu features that select the simd code
+ * of openssl and blake3 are printed along with the results */
+
+#include "hashsumr.h"
+
+#define	SPEED_MSEC	250	/* per algorithm, size, and thread count */
+#define	SPEED_MAXSIZE	(1<<20)	/* the largest buffer */
+
+int speed_run(md_t **algs, int nalgs, int nthreads);
+
+#endif	/* __SPEED_H__ */
@@ -0,0 +1,229 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "hashsumr.h"
+#include "stats.h"
+
+typedef struct slow_s {
+	unsigned long long total;
+	filestat_t fs;
+	char *filename;
+}	slow_t;
+
+typedef struct wstat_s {
+	int used;
+	unsigned long long busy, idle, output;
+}	wstat_t;
+
+struct stats_s {
+	unsigned long long start;
+	pthread_mutex_t mutex;
+	FILE *json;	/* one line per file, or NULL */
+	unsigned long long files, errors;
+	filestat_t sum;
+	unsigned long long hist[STATS_BUCKETS];	/* file times, for percentiles */
+	unsigned long long maxtime;
+	slow_t slow[STATS_TOPN];	/* slowest first */
+	int nslow;
+	wstat_t *workers;
+	int nworkers;
+};
+
+unsigned long long	/* monotonic clock, ns */
+stats_now() {
+#ifdef _WIN32
+	static LARGE_INTEGER freq;
+	LARGE_INTEGER c;
+	if(freq.QuadPart == 0) QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&c);
+	return (unsigned long long) (c.QuadPart / freq.QuadPart) * 1000000000ULL
+		+ (unsigned long long) (c.QuadPart % freq.QuadPart) * 1000000000ULL / freq.QuadPart;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+stats_t *	/* NULL and errno if the json file cannot be created */
+stats_open(const TCHAR *jsonpath) {
+	stats_t *s;
+	if((s = (stats_t *) calloc(1, sizeof(stats_t))) == NULL)
+		return NULL;
+	if(jsonpath != NULL) {
+#ifdef _WIN32
+		s->json = _wfopen(jsonpath, L"wb");
+#else
+		s->json = fopen(jsonpath, "w");
+#endif
+		if(s->json == NULL) {
+			free(s);
+			return NULL;
+		}
+	}
+	pthread_mutex_init(&s->mutex, NULL);
+	s->start = stats_now();
+	return s;
+}
+
+static void	/* a json string, utf-8 is passed as is */
+json_string(FILE *fp, const char *s) {
+	fputc('"', fp);
+	for(; *s; s++) {
+		unsigned char c = (unsigned char) *s;
+		if(c == '"' || c == '\\') {
+			fputc('\\', fp);
+			fputc(c, fp);
+		} else if(c < 0x20) {
+			fprintf(fp, "\\u%04x", c);
+		} else {
+			fputc(c, fp);
+		}
+	}
+	fputc('"', fp);
+}
+
+static int	/* the log-linear bucket of a time: exact below STATS_SUB ns, then
+	 * STATS_SUB buckets between two powers of 2 */
+hist_bucket(unsigned long long t) {
+	int e = 0;
+	if(t < STATS_SUB)
+		return (int) t;
+	while((t >> e) >= 2 * STATS_SUB)
+		e++;
+	return (e + 1) * STATS_SUB + (int) ((t >> e) - STATS_SUB);
+}
+
+static unsigned long long	/* the largest time of a bucket */
+hist_value(int b) {
+	int e = b / STATS_SUB - 1;
+	if(b < STATS_SUB)
+		return b;
+	return (((unsigned long long) (STATS_SUB + b % STATS_SUB) + 1) << e) - 1;
+}
+
+static void
+add_slow(stats_t *s, const job_t *job, const filestat_t *fs, unsigned long long total) {
+	char *name;
+	int i;
+	if(s->nslow == STATS_TOPN && total <= s->slow[STATS_TOPN-1].total)
+		return;
+	if((name = strdup(job->filename)) == NULL)
+		return;
+	if(s->nslow == STATS_TOPN)
+		free(s->slow[--s->nslow].filename);
+	for(i = s->nslow; i > 0 && s->slow[i-1].total < total; i--)
+		s->slow[i] = s->slow[i-1];
+	s->slow[i].total = total;
+	s->slow[i].fs = *fs;
+	s->slow[i].filename = name;
+	s->nslow++;
+}
+
+void	/* a file is done, thread-safe */
+stats_file(stats_t *s, const job_t *job, const filestat_t *fs) {
+	unsigned long long total = fs->open + fs->read + fs->hash;
+	pthread_mutex_lock(&s->mutex);
+	s->files++;
+	if(job->code != STATE_DONE) s->errors++;
+	s->sum.open += fs->open;
+	s->sum.read += fs->read;
+	s->sum.hash += fs->hash;
+	s->sum.bytes += fs->bytes;
+	s->hist[hist_bucket(total)]++;
+	if(total > s->maxtime) s->maxtime = total;
+	add_slow(s, job, fs, total);
+	if(s->json != NULL) {
+		fprintf(s->json, "{\"file\":");
+		json_string(s->json, job->filename);
+		fprintf(s->json, ",\"ok\":%s,\"bytes\":%llu,\"open_ns\":%llu,\"read_ns\":%llu,\"hash_ns\":%llu,\"total_ns\":%llu",
+			job->code == STATE_DONE ? "true" : "false", fs->bytes, fs->open, fs->read, fs->hash, total);
+		if(job->code != STATE_DONE && job->errmsg != NULL) {
+			fprintf(s->json, ",\"error\":");
+			json_string(s->json, job->errmsg);
+		}
+		fprintf(s->json, "}\n");
+	}
+	pthread_mutex_unlock(&s->mutex);
+}
+
+void	/* a worker quits, ns spent hashing, waiting for jobs, and waiting to print */
+stats_worker(stats_t *s, int id, unsigned long long busy, unsigned long long idle, unsigned long long output) {
+	pthread_mutex_lock(&s->mutex);
+	if(id >= s->nworkers) {
+		wstat_t *p;
+		if((p = (wstat_t *) realloc(s->workers, (id + 1) * sizeof(wstat_t))) != NULL) {
+			memset(p + s->nworkers, 0, (id + 1 - s->nworkers) * sizeof(wstat_t));
+			s->workers = p;
+			s->nworkers = id + 1;
+		}
+	}
+	if(id < s->nworkers) {
+		s->workers[id].used = 1;
+		s->workers[id].busy = busy;
+		s->workers[id].idle = idle;
+		s->workers[id].output = output;
+	}
+	pthread_mutex_unlock(&s->mutex);
+}
+
+static double
+ms(unsigned long long ns) {
+	return ns / 1e6;
+}
+
+static unsigned long long	/* nearest rank, the top of its bucket but no more than the max */
+percentile(const stats_t *s, int p) {
+	unsigned long long r = (s->files * p + 99) / 100, n = 0;
+	int b;
+	if(r == 0) r = 1;
+	for(b = 0; b < STATS_BUCKETS; b++) {
+		if((n += s->hist[b]) >= r)
+			break;
+	}
+	return b < STATS_BUCKETS && hist_value(b) < s->maxtime ? hist_value(b) : s->maxtime;
+}
+
+void	/* summary of the run, call after the workers quit */
+stats_report(stats_t *s, FILE *fp) {
+	unsigned long long wall = stats_now() - s->start;
+	double sec = wall > 0 ? wall / 1e9 : 1e-9;
+	int i;
+	fprintf(fp, "hashsumr: stats: %llu files (%llu failed), %llu bytes in %.3fs, %.1f MB/s, %.0f files/s\n",
+		s->files, s->errors, s->sum.bytes, wall / 1e9, s->sum.bytes / sec / 1e6, s->files / sec);
+	fprintf(fp, "hashsumr: stats: summed over files: open %.3fs, read %.3fs, hash %.3fs\n",
+		s->sum.open / 1e9, s->sum.read / 1e9, s->sum.hash / 1e9);
+	if(s->files > 0) {
+		fprintf(fp, "hashsumr: stats: time per file: p50 %.3fms, p90 %.3fms, p99 %.3fms, max %.3fms\n",
+			ms(percentile(s, 50)), ms(percentile(s, 90)), ms(percentile(s, 99)), ms(s->maxtime));
+	}
+	for(i = 0; i < s->nworkers; i++) {
+		if(s->workers[i].used == 0) continue;
+		fprintf(fp, "hashsumr: stats: worker %d: busy %.3fs, idle %.3fs, output %.3fs\n", i,
+			s->workers[i].busy / 1e9, s->workers[i].idle / 1e9, s->workers[i].output / 1e9);
+	}
+	if(s->nslow > 0)
+		fprintf(fp, "hashsumr: stats: slowest files (total, open, read, hash ms, bytes):\n");
+	for(i = 0; i < s->nslow; i++) {
+		const slow_t *w = &s->slow[i];
+		fprintf(fp, "  %10.3f %9.3f %9.3f %9.3f %12llu  %s\n", ms(w->total),
+			ms(w->fs.open), ms(w->fs.read), ms(w->fs.hash), w->fs.bytes, w->filename);
+	}
+	fflush(fp);
+}
+
+int	/* 0 or errno of the json file */
+stats_close(stats_t *s) {
+	int i, err = 0;
+	if(s == NULL)
+		return 0;
+	if(s->json != NULL && (ferror(s->json) || fclose(s->json) != 0))
+		err = errno ? errno : EIO;
+	for(i = 0; i < s->nslow; i++)
+		free(s->slow[i].filename);
+	free(s->workers);
+	pthread_mutex_destroy(&s->mutex);
+	free(s);
+	return err;
+}
@@ -0,0 +1,33 @@
+#ifndef __STATS_H__
+#define __STATS_H__
+
+/* per-file timings and per-worker idle time (--stats, --stats-json).
+ * hash1() times the stat and open of a file, the digest updates and
+ * finals, and counts the rest of the read loop as blocked in reads:
+ * mmap page faults count as hashing, and split blake3 files, hashed
+ * by several workers, count all their time as hashing */
+
+#include <stdio.h>
+#include "hashsumr.h"
+
+#define	STATS_TOPN	10	/* slowest files in the summary */
+#define	STATS_SUB	16	/* histogram buckets per power of 2, percentiles within 1/16 */
+#define	STATS_BUCKETS	((64 - 3) * STATS_SUB)	/* any time in ns, a fixed size for any # of files */
+
+typedef struct filestat_s {
+	unsigned long long open;	/* stat, cache lookup, and open, ns */
+	unsigned long long read;	/* blocked in reads, ns */
+	unsigned long long hash;	/* fupdate and ffinal, ns */
+	unsigned long long bytes;
+}	filestat_t;
+
+typedef struct stats_s stats_t;
+
+unsigned long long stats_now();
+stats_t * stats_open(const TCHAR *jsonpath);
+void   stats_file(stats_t *s, const job_t *job, const filestat_t *fs);
+void   stats_worker(stats_t *s, int id, unsigned long long busy, unsigned long long idle, unsigned long long output);
+void   stats_report(stats_t *s, FILE *fp);
+int    stats_close(stats_t *s);
+
+#endif	/* __STATS_H__ */
@@ -0,0 +1,184 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#include <fcntl.h>
+#endif
+#include "hashsumr.h"
+#include "bufpool.h"
+#include "stream.h"
+
+/* one ring and reader thread per worker, created by the first file it
+ * streams and kept until stream_release(), files only hand over their
+ * descriptor */
+typedef struct ring_s {
+	int fd;	/* file being read, -1 while the reader waits for one */
+	int quit;
+	size_t bsize;
+	buf_t bufs;	/* STREAM_NBUFS * bsize */
+	size_t len[STREAM_NBUFS];
+	int head, count;	/* next buffer to consume, # of full buffers */
+	int eof;
+	int err;	/* errno of a failed read */
+	pthread_t tid;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+}	ring_t;
+
+static THREAD_LOCAL ring_t *ring;
+
+static void	/* fill the ring from r->fd until the end of the file */
+reader_file(ring_t *r, int fd) {
+	int tail = 0, err = 0, sz;
+	while(1) {
+		char *p = r->bufs.ptr + (size_t) tail * r->bsize;
+		size_t len = 0;
+		pthread_mutex_lock(&r->mutex);
+		while(r->count >= STREAM_NBUFS)
+			pthread_cond_wait(&r->cond, &r->mutex);
+		pthread_mutex_unlock(&r->mutex);
+		/* fill a whole buffer, pipes return a few pages at a time */
+		while(len < r->bsize) {
+			if((sz = read(fd, p + len, (unsigned int) (r->bsize - len))) > 0) {
+				len += sz;
+				continue;
+			}
+			if(sz < 0 && errno == EINTR)
+				continue;
+#ifdef O_DIRECT
+			if(sz < 0 && errno == EINVAL) {
+				/* unaligned tail of an O_DIRECT file, finish it through the page cache */
+				int fl = fcntl(fd, F_GETFL);
+				if(fl != -1 && (fl & O_DIRECT) && fcntl(fd, F_SETFL, fl & ~O_DIRECT) == 0)
+					continue;
+			}
+#endif
+			if(sz < 0) err = errno;
+			break;
+		}
+		pthread_mutex_lock(&r->mutex);
+		if(len > 0) {
+			r->len[tail] = len;
+			r->count++;
+			tail = (tail + 1) % STREAM_NBUFS;
+		}
+		if(len < r->bsize) {
+			/* done with this file, wait for the next one */
+			r->eof = 1;
+			r->err = err;
+			r->fd = -1;
+		}
+		pthread_cond_broadcast(&r->cond);
+		pthread_mutex_unlock(&r->mutex);
+		if(len < r->bsize)
+			break;
+	}
+}
+
+static void *
+reader(void *arg) {
+	ring_t *r = (ring_t *) arg;
+	int fd;
+	while(1) {
+		pthread_mutex_lock(&r->mutex);
+		while(r->fd < 0 && r->quit == 0)
+			pthread_cond_wait(&r->cond, &r->mutex);
+		fd = r->fd;
+		pthread_mutex_unlock(&r->mutex);
+		if(fd < 0)
+			break;
+		reader_file(r, fd);
+	}
+	return NULL;
+}
+
+void	/* called by a thread before it quits, stops its reader */
+stream_release() {
+	ring_t *r = ring;
+	if(r == NULL)
+		return;
+	pthread_mutex_lock(&r->mutex);
+	r->quit = 1;
+	pthread_cond_broadcast(&r->cond);
+	pthread_mutex_unlock(&r->mutex);
+	pthread_join(r->tid, NULL);
+	pthread_mutex_destroy(&r->mutex);
+	pthread_cond_destroy(&r->cond);
+	bufpool_free(&r->bufs);
+	free(r);
+	ring = NULL;
+}
+
+static ring_t *	/* the ring of this thread, NULL and errno if it cannot be created */
+stream_get(size_t bsize) {
+	ring_t *r;
+	int err;
+	if(ring != NULL && ring->bsize == bsize)
+		return ring;
+	stream_release();
+	if((r = (ring_t *) calloc(1, sizeof(ring_t))) == NULL)
+		return NULL;
+	r->fd = -1;
+	r->bsize = bsize;
+	if(bufpool_alloc(&r->bufs, bsize * STREAM_NBUFS, 0) != 0) {
+		free(r);
+		errno = ENOMEM;
+		return NULL;
+	}
+	pthread_mutex_init(&r->mutex, NULL);
+	pthread_cond_init(&r->cond, NULL);
+	if((err = pthread_create(&r->tid, NULL, reader, r)) != 0) {
+		pthread_mutex_destroy(&r->mutex);
+		pthread_cond_destroy(&r->cond);
+		bufpool_free(&r->bufs);
+		free(r);
+		errno = err;
+		return NULL;
+	}
+	return ring = r;
+}
+
+int	/* 0, errno of a failed read, or -2 if consume() fails. all the input
+	 * is read even if consume() fails, so the reader never blocks forever */
+stream_readfile(int fd, size_t bsize, stream_consumer_t consume, void *arg) {
+	ring_t *r;
+	int failed = 0;
+	if((r = stream_get(bsize)) == NULL)
+		return errno ? errno : ENOMEM;
+	pthread_mutex_lock(&r->mutex);
+	r->head = r->count = 0;
+	r->eof = r->err = 0;
+	r->fd = fd;
+	pthread_cond_broadcast(&r->cond);
+	pthread_mutex_unlock(&r->mutex);
+	while(1) {
+		char *p;
+		size_t len;
+		pthread_mutex_lock(&r->mutex);
+		while(r->count == 0 && r->eof == 0)
+			pthread_cond_wait(&r->cond, &r->mutex);
+		if(r->count == 0) {
+			/* the reader is done with fd and waits for the next file */
+			pthread_mutex_unlock(&r->mutex);
+			break;
+		}
+		p = r->bufs.ptr + (size_t) r->head * bsize;
+		len = r->len[r->head];
+		pthread_mutex_unlock(&r->mutex);
+		/* the reader fills the other buffers meanwhile */
+		if(failed == 0 && consume(p, len, arg) != 0)
+			failed = 1;
+		pthread_mutex_lock(&r->mutex);
+		r->head = (r->head + 1) % STREAM_NBUFS;
+		r->count--;
+		pthread_cond_broadcast(&r->cond);
+		pthread_mutex_unlock(&r->mutex);
+	}
+	if(failed)
+		return -2;
+	return r->err;
+}
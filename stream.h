@@ -0,0 +1,18 @@
+#ifndef __STREAM_H__
+#define __STREAM_H__
+
+/* reads a file through a ring of buffers: a reader thread fills them
+ * while the caller consumes them, so waiting for the writer of a pipe
+ * (or the disk, for a large file) and hashing overlap. each thread keeps
+ * its ring and reader for all its files, until stream_release() */
+
+#include <stddef.h>
+
+#define	STREAM_NBUFS	4	/* buffers in the ring */
+
+typedef int (*stream_consumer_t)(void *buf, size_t len, void *arg);
+
+int  stream_readfile(int fd, size_t bsize, stream_consumer_t consume, void *arg);
+void stream_release();
+
+#endif	/* __STREAM_H__ */
@@ -0,0 +1,116 @@
+#!/usr/bin/env bash
+# end-to-end regression tests: hashsumr against itself in the modes whose
+# output must not depend on how the work was spread over the workers.
+# prints one line per failure on stderr, exits 1 if any test failed.
+#
+# usage: tests/run.sh [path/to/hashsumr]
+#
+# environment:
+#   TEST_DIR       scratch directory [mktemp -d, removed]
+
+set -u
+export LC_ALL=C
+
+BIN=${1:-./hashsumr}
+SPLIT=$((16 << 20))	# HASHSUMR_SPLIT_SIZE
+
+if [ ! -x "$BIN" ]; then
+	echo "tests: $BIN is not an executable" >&2
+	exit 1
+fi
+
+if [ -n "${TEST_DIR:-}" ]; then
+	DIR=$TEST_DIR
+	mkdir -p "$DIR" || exit 1
+else
+	DIR=$(mktemp -d "${TMPDIR:-/tmp}/hashsumr-test.XXXXXX") || exit 1
+	trap 'rm -rf "$DIR"' EXIT
+fi
+
+failed=0
+ran=0
+
+fail() {
+	echo "tests: FAIL: $*" >&2
+	failed=$((failed + 1))
+}
+
+digests() {	# the digest column of BSD-style lines
+	awk '{ print $NF }'
+}
+
+# split blake3: the subtrees hashed by several workers give the digest of
+# the sequential path, for pieces that end on and off a buffer boundary
+test_split() {
+	local size bufsize f a b
+	echo x > "$DIR/small"
+	for size in $((2 * SPLIT + 1)) $((3 * SPLIT)) $((3 * SPLIT + 1)); do
+		f="$DIR/split-$size"
+		head -c "$size" /dev/urandom > "$f" || return
+		b=$("$BIN" -1 -a blake3 "$f" 2>/dev/null | digests)
+		for bufsize in 64K 100K 128K 1M; do
+			ran=$((ran + 1))
+			a=$("$BIN" -a blake3 --workers 2 --buffer-size "$bufsize" "$f" "$DIR/small" 2>/dev/null | head -1 | digests)
+			[ -n "$b" ] && [ "$a" = "$b" ] || fail "split blake3, $size bytes, --buffer-size $bufsize: $a != $b"
+		done
+		rm -f "$f"
+	done
+}
+
+# a single large blake3 file is not left to one worker
+test_split_single() {
+	local f="$DIR/split-single" a b
+	head -c $((2 * SPLIT + 1)) /dev/urandom > "$f" || return
+	ran=$((ran + 1))
+	a=$("$BIN" -a blake3 --workers 2 "$f" 2>&1 >/dev/null | grep -c "workers = 2;")
+	[ "$a" = 1 ] || fail "split blake3, single file: not hashed by 2 workers"
+	ran=$((ran + 1))
+	a=$("$BIN" -a blake3 --workers 2 "$f" 2>/dev/null | digests)
+	b=$("$BIN" -1 -a blake3 "$f" 2>/dev/null | digests)
+	[ -n "$b" ] && [ "$a" = "$b" ] || fail "split blake3, single file: $a != $b"
+	rm -f "$f"
+}
+
+# --schedule changes the order jobs start in, not the order of the output
+test_schedule() {
+	local d="$DIR/sched" a b policy
+	mkdir -p "$d" || return
+	head -c 1 /dev/urandom > "$d/f1"
+	head -c 1000 /dev/urandom > "$d/f1000"
+	head -c 131073 /dev/urandom > "$d/f131073"
+	head -c $((3 << 20)) /dev/urandom > "$d/f3m"
+	b=$("$BIN" --workers 2 --schedule input "$d/f1" "$d/f1000" "$d/f131073" "$d/f3m" 2>/dev/null)
+	for policy in largest-first size-balanced; do
+		ran=$((ran + 1))
+		a=$("$BIN" --workers 2 --schedule "$policy" "$d/f1" "$d/f1000" "$d/f131073" "$d/f3m" 2>/dev/null)
+		[ -n "$b" ] && [ "$a" = "$b" ] || fail "--schedule $policy: output not in input order"
+	done
+	rm -rf "$d"
+}
+
+# a fifo is opened once, by the stream path, so its writer is never
+# cut off by an open and close that only looked at the file type
+test_fifo() {
+	local f="$DIR/fifo" data="$DIR/fifo-data" a b i
+	mkfifo "$f" 2>/dev/null || return
+	echo x > "$DIR/small"
+	head -c 300000 /dev/urandom > "$data" || return
+	b=$("$BIN" -1 "$data" 2>/dev/null | digests)
+	for i in 1 2 3 4 5 6 7 8 9 10; do
+		ran=$((ran + 1))
+		cat "$data" > "$f" 2>/dev/null &
+		a=$(timeout 10 "$BIN" --workers 2 "$DIR/small" "$f" "$DIR/small" 2>/dev/null | sed -n 2p | digests)
+		kill $! 2>/dev/null
+		wait $! 2>/dev/null
+		[ -n "$b" ] && [ "$a" = "$b" ] || { fail "fifo, run $i: $a != $b"; break; }
+	done
+	rm -f "$f" "$data"
+}
+
+test_split
+test_split_single
+test_schedule
+test_fifo
+
+echo "tests: $ran run, $failed failed" >&2
+[ "$failed" -eq 0 ]
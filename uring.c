@@ -0,0 +1,274 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "uring.h"
+#include "bufpool.h"
+
+#ifdef HAVE_IO_URING
+
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+typedef struct uring_s {
+	int fd;
+	unsigned depth;
+	unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+	unsigned *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	void *sq_ptr, *cq_ptr;
+	size_t sq_sz, cq_sz, sqes_sz;
+	unsigned tail;		/* local sq tail, published by uring_enter() */
+	int fixed;		/* buffers are registered */
+	size_t bsize;		/* bytes per read request */
+	buf_t bufs;		/* depth * bsize, page aligned */
+}	uring_t;
+
+typedef struct slot_s {
+	unsigned long long off;
+	size_t want;	/* bytes of the file in this block */
+	size_t len;	/* requested, aligned for O_DIRECT */
+	size_t filled;	/* received */
+	int inflight;
+	int err;
+	int eof;
+}	slot_t;
+
+static pthread_key_t  ring_key;
+static pthread_once_t ring_once = PTHREAD_ONCE_INIT;
+
+static void
+uring_destroy(void *arg) {
+	uring_t *r = (uring_t *) arg;
+	if(r == NULL) return;
+	if(r->sqes != NULL && r->sqes != MAP_FAILED) munmap(r->sqes, r->sqes_sz);
+	if(r->cq_ptr != NULL && r->cq_ptr != MAP_FAILED && r->cq_ptr != r->sq_ptr) munmap(r->cq_ptr, r->cq_sz);
+	if(r->sq_ptr != NULL && r->sq_ptr != MAP_FAILED) munmap(r->sq_ptr, r->sq_sz);
+	if(r->fd >= 0) close(r->fd);
+	bufpool_free(&r->bufs);
+	free(r);
+}
+
+static void
+uring_key_init() {
+	pthread_key_create(&ring_key, uring_destroy);
+}
+
+static uring_t *
+uring_create(unsigned depth, size_t bsize, int huge) {
+	struct io_uring_params p;
+	struct iovec iov[URING_MAX_DEPTH];
+	uring_t *r;
+	unsigned i;
+	if((r = (uring_t *) calloc(1, sizeof(uring_t))) == NULL)
+		return NULL;
+	memset(&p, 0, sizeof(p));
+	if((r->fd = (int) syscall(__NR_io_uring_setup, depth, &p)) < 0) {
+		free(r);
+		return NULL;
+	}
+	r->depth = depth;
+	r->sq_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	r->cq_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if(p.features & IORING_FEAT_SINGLE_MMAP) {
+		if(r->cq_sz > r->sq_sz) r->sq_sz = r->cq_sz;
+		r->cq_sz = r->sq_sz;
+	}
+	r->sq_ptr = mmap(NULL, r->sq_sz, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+	if(r->sq_ptr == MAP_FAILED) goto failed;
+	if(p.features & IORING_FEAT_SINGLE_MMAP) {
+		r->cq_ptr = r->sq_ptr;
+	} else {
+		r->cq_ptr = mmap(NULL, r->cq_sz, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+		if(r->cq_ptr == MAP_FAILED) goto failed;
+	}
+	r->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+	r->sqes = (struct io_uring_sqe *) mmap(NULL, r->sqes_sz, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, r->fd, IORING_OFF_SQES);
+	if(r->sqes == MAP_FAILED) goto failed;
+	r->sq_head  = (unsigned *) ((char *) r->sq_ptr + p.sq_off.head);
+	r->sq_tail  = (unsigned *) ((char *) r->sq_ptr + p.sq_off.tail);
+	r->sq_mask  = (unsigned *) ((char *) r->sq_ptr + p.sq_off.ring_mask);
+	r->sq_array = (unsigned *) ((char *) r->sq_ptr + p.sq_off.array);
+	r->cq_head  = (unsigned *) ((char *) r->cq_ptr + p.cq_off.head);
+	r->cq_tail  = (unsigned *) ((char *) r->cq_ptr + p.cq_off.tail);
+	r->cq_mask  = (unsigned *) ((char *) r->cq_ptr + p.cq_off.ring_mask);
+	r->cqes = (struct io_uring_cqe *) ((char *) r->cq_ptr + p.cq_off.cqes);
+	r->tail = *r->sq_tail;
+	/* aligned buffers, registered if the kernel lets us pin them */
+	r->bsize = (bsize + BUFPOOL_ALIGN - 1) & ~((size_t) BUFPOOL_ALIGN - 1);
+	if(bufpool_alloc(&r->bufs, (size_t) depth * r->bsize, huge) != 0)
+		goto failed;
+	for(i = 0; i < depth; i++) {
+		iov[i].iov_base = r->bufs.ptr + (size_t) i * r->bsize;
+		iov[i].iov_len  = r->bsize;
+	}
+	r->fixed = (syscall(__NR_io_uring_register, r->fd, IORING_REGISTER_BUFFERS, iov, depth) == 0);
+	return r;
+failed:
+	uring_destroy(r);
+	return NULL;
+}
+
+static uring_t *	/* one ring per (worker) thread, created on first use */
+uring_get(int depth, size_t bsize, int huge) {
+	uring_t *r;
+	if(depth < 1) depth = 1;
+	if(depth > URING_MAX_DEPTH) depth = URING_MAX_DEPTH;
+	pthread_once(&ring_once, uring_key_init);
+	if((r = (uring_t *) pthread_getspecific(ring_key)) != NULL)
+		return r;
+	if((r = uring_create(depth, bsize, huge)) != NULL)
+		pthread_setspecific(ring_key, r);
+	return r;
+}
+
+static void
+uring_prep_read(uring_t *r, int fd, unsigned idx, slot_t *s) {
+	unsigned i = r->tail & *r->sq_mask;
+	struct io_uring_sqe *sqe = &r->sqes[i];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = r->fixed ? IORING_OP_READ_FIXED : IORING_OP_READ;
+	sqe->fd = fd;
+	sqe->off = s->off + s->filled;
+	sqe->addr = (unsigned long) (r->bufs.ptr + (size_t) idx * r->bsize + s->filled);
+	sqe->len = (unsigned) (s->len - s->filled);
+	sqe->buf_index = r->fixed ? idx : 0;
+	sqe->user_data = idx;
+	r->sq_array[i] = i;
+	r->tail++;
+	s->inflight = 1;
+}
+
+static int	/* submit pending sqes and wait for at least one completion */
+uring_enter(uring_t *r) {
+	int ret;
+	unsigned submit;
+	__atomic_store_n(r->sq_tail, r->tail, __ATOMIC_RELEASE);
+	submit = r->tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+	do {
+		ret = (int) syscall(__NR_io_uring_enter, r->fd, submit, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+	} while(ret < 0 && errno == EINTR);
+	return ret < 0 ? errno : 0;
+}
+
+static void	/* move completions into their slots, re-queue short reads */
+uring_reap(uring_t *r, int fd, slot_t *slots) {
+	unsigned head = *r->cq_head;
+	while(head != __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE)) {
+		struct io_uring_cqe *cqe = &r->cqes[head & *r->cq_mask];
+		slot_t *s = &slots[cqe->user_data];
+		s->inflight = 0;
+		if(cqe->res < 0) {
+			if(cqe->res == -EAGAIN || cqe->res == -EINTR)
+				uring_prep_read(r, fd, (unsigned) cqe->user_data, s);
+			else
+				s->err = -cqe->res;
+		} else if(cqe->res == 0) {
+			s->eof = 1;
+		} else {
+			s->filled += cqe->res;
+			if(s->filled < s->want)
+				uring_prep_read(r, fd, (unsigned) cqe->user_data, s);
+		}
+		head++;
+	}
+	__atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+}
+
+int
+uring_available() {
+	uring_t *r;
+	if((r = uring_create(1, BUFPOOL_ALIGN, 0)) == NULL)
+		return 0;
+	uring_destroy(r);
+	return 1;
+}
+
+static void
+uring_slot_next(uring_t *r, slot_t *s, unsigned long long *next, unsigned long long fsize) {
+	s->off = *next;
+	s->want = (fsize - *next) > r->bsize ? r->bsize : (size_t) (fsize - *next);
+	s->len = (s->want + BUFPOOL_ALIGN - 1) & ~((size_t) BUFPOOL_ALIGN - 1);
+	s->filled = 0;
+	*next += s->want;
+}
+
+/* read [0, fsize) of fd with up to depth requests of bsize bytes in flight
+ * and pass the blocks to consume() in file order. *done is the number of
+ * bytes consumed. return 0 on success, -1 if io_uring is unavailable, -2 if
+ * consume() failed, or the errno of a failed read. */
+int
+uring_readfile(int fd, unsigned long long fsize, int depth, size_t bsize, int huge,
+		uring_consumer_t consume, void *arg, unsigned long long *done) {
+	uring_t *r;
+	slot_t slots[URING_MAX_DEPTH];
+	unsigned long long next = 0;
+	unsigned i, cur = 0, inflight = 0;
+	int err = 0;
+	*done = 0;
+	if((r = uring_get(depth, bsize, huge)) == NULL)
+		return -1;
+	memset(slots, 0, sizeof(slots));
+	for(i = 0; i < r->depth && next < fsize; i++) {
+		uring_slot_next(r, &slots[i], &next, fsize);
+		uring_prep_read(r, fd, i, &slots[i]);
+	}
+	while(*done < fsize && err == 0) {
+		slot_t *s = &slots[cur];
+		while(s->inflight) {
+			if((err = uring_enter(r)) != 0) goto drain;
+			uring_reap(r, fd, slots);
+		}
+		if((err = s->err) != 0) break;
+		/* an aligned tail read may return more than we asked for if the file grew */
+		if(s->filled > s->want) s->filled = s->want;
+		if(s->filled > 0 && consume(r->bufs.ptr + (size_t) cur * r->bsize, s->filled, arg) != 0) {
+			err = -2;
+			break;
+		}
+		*done += s->filled;
+		if(s->eof) break;	/* file shrunk */
+		if(next < fsize) {
+			uring_slot_next(r, s, &next, fsize);
+			uring_prep_read(r, fd, cur, s);
+		} else {
+			s->want = s->len = s->filled = 0;
+		}
+		cur = (cur + 1) % r->depth;
+	}
+drain:
+	/* the kernel may still write into our buffers, wait for them */
+	for(i = 0, inflight = 0; i < r->depth; i++) inflight += slots[i].inflight;
+	while(inflight > 0) {
+		if(uring_enter(r) != 0) {
+			/* should not happen, give up the ring rather than reuse busy buffers */
+			pthread_setspecific(ring_key, NULL);
+			uring_destroy(r);
+			break;
+		}
+		uring_reap(r, fd, slots);
+		for(i = 0, inflight = 0; i < r->depth; i++) inflight += slots[i].inflight;
+	}
+	return err;
+}
+
+#else	/* !HAVE_IO_URING */
+
+int
+uring_available() {
+	return 0;
+}
+
+int
+uring_readfile(int fd, unsigned long long fsize, int depth, size_t bsize, int huge,
+		uring_consumer_t consume, void *arg, unsigned long long *done) {
+	*done = 0;
+	return -1;
+}
+
+#endif
@@ -0,0 +1,22 @@
+#ifndef __URING_H__
+#define __URING_H__
+
+#include <stddef.h>
+
+/* io_uring read engine (linux only), built without liburing */
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define HAVE_IO_URING	1
+#endif
+#endif
+
+#define	URING_MAX_DEPTH	128
+
+typedef int (*uring_consumer_t)(void *buf, size_t len, void *arg);
+
+int uring_available();
+int uring_readfile(int fd, unsigned long long fsize, int depth, size_t bsize, int huge,
+	uring_consumer_t consume, void *arg, unsigned long long *done);
+
+#endif	/* __URING_H__ */
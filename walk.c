@@ -0,0 +1,375 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#include <dirent.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+#endif
+#include "hashsumr.h"
+#include "walk.h"
+
+#define PREFIX	"hashsumr: "
+
+#ifdef _WIN32
+#define	tcslen	wcslen
+#else
+#define	tcslen	strlen
+#endif
+
+/* a directory waiting to be listed */
+typedef struct walkdir_s {
+	TCHAR *path;
+	unsigned long long dev;	/* of the root, for walkopt_t.xdev */
+	struct walkdir_s *link;
+}	walkdir_t;
+
+/* regular files found by one thread, flushed to the callback */
+typedef struct walkbatch_s {
+	TCHAR *paths[WALK_BATCH];
+	int n;
+}	walkbatch_t;
+
+static pthread_mutex_t mutex_walk = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  cond_walk = PTHREAD_COND_INITIALIZER;
+static walkdir_t *pending = NULL;	/* lifo keeps the walk close to depth-first */
+static int busy = 0;	/* threads listing a directory */
+static int running = 0;	/* walker threads alive */
+static volatile int errors = 0;
+static walkopt_t wopt;
+static walk_emit_t wemit;
+static walk_done_t wdone;
+static void *warg;
+static writer_t *werr;	/* errors, in order with those of the workers */
+
+#ifndef _WIN32
+/* directories already seen, only when following symlinks */
+typedef struct devino_s {
+	unsigned long long dev;
+	unsigned long long ino;
+}	devino_t;
+
+static devino_t *visited = NULL;
+static size_t nvisited = 0, szvisited = 0;
+
+static int	/* 1 if the directory was seen before, otherwise remember it. with mutex_walk held */
+walk_visited(unsigned long long dev, unsigned long long ino) {
+	size_t i, h;
+	if(nvisited * 2 >= szvisited) {
+		/* grow the open-addressing table */
+		size_t nsz = szvisited ? szvisited * 2 : 1024, n = 0;
+		devino_t *o, *old = visited;
+		size_t osz = szvisited;
+		if((visited = (devino_t *) calloc(nsz, sizeof(devino_t))) == NULL) {
+			visited = old;
+			return 0;	/* walk on, at worst a loop is listed twice */
+		}
+		szvisited = nsz;
+		nvisited = 0;
+		for(i = 0; i < osz; i++) {
+			o = &old[i];
+			if(o->dev == 0 && o->ino == 0) continue;
+			for(h = (o->dev * 31 + o->ino) & (nsz - 1); visited[h].ino || visited[h].dev; h = (h + 1) & (nsz - 1));
+			visited[h] = *o;
+			n++;
+		}
+		nvisited = n;
+		free(old);
+	}
+	for(h = (dev * 31 + ino) & (szvisited - 1); visited[h].ino || visited[h].dev; h = (h + 1) & (szvisited - 1)) {
+		if(visited[h].dev == dev && visited[h].ino == ino)
+			return 1;
+	}
+	visited[h].dev = dev;
+	visited[h].ino = ino;
+	nvisited++;
+	return 0;
+}
+#endif
+
+static void
+walk_error(const TCHAR *path, int err) {
+	char msg[128];
+	ATOMIC_ADD(&errors, 1);
+#ifdef _WIN32
+	writer_printf(werr, PREFIX "%ls: %s\n", path, herrmsg(msg, sizeof(msg), err));
+#else
+	writer_printf(werr, PREFIX "%s: %s\n", path, herrmsg(msg, sizeof(msg), err));
+#endif
+}
+
+static TCHAR *
+walk_join(const TCHAR *dir, const TCHAR *name, size_t namelen) {
+	size_t len = tcslen(dir);
+	TCHAR *path;
+	int sep = (len > 0 && dir[len-1] != _T('/')
+#ifdef _WIN32
+		&& dir[len-1] != _T('\\')
+#endif
+		);
+	if((path = (TCHAR *) malloc(sizeof(TCHAR) * (len + sep + namelen + 1))) == NULL)
+		return NULL;
+	memcpy(path, dir, sizeof(TCHAR) * len);
+#ifdef _WIN32
+	if(sep) path[len++] = _T('\\');
+#else
+	if(sep) path[len++] = _T('/');
+#endif
+	memcpy(path + len, name, sizeof(TCHAR) * namelen);
+	path[len + namelen] = 0;
+	return path;
+}
+
+static void
+walk_push(TCHAR *path, unsigned long long dev) {
+	walkdir_t *wd;
+	if((wd = (walkdir_t *) malloc(sizeof(walkdir_t))) == NULL) {
+		walk_error(path, ENOMEM);
+		free(path);
+		return;
+	}
+	wd->path = path;
+	wd->dev = dev;
+	pthread_mutex_lock(&mutex_walk);
+	wd->link = pending;
+	pending = wd;
+	pthread_cond_signal(&cond_walk);
+	pthread_mutex_unlock(&mutex_walk);
+}
+
+static void
+walk_flush(walkbatch_t *b) {
+	if(b->n == 0) return;
+	wemit(b->paths, b->n, warg);
+	b->n = 0;
+}
+
+static void
+walk_file(walkbatch_t *b, TCHAR *path) {
+	b->paths[b->n++] = path;
+	if(b->n == WALK_BATCH)
+		walk_flush(b);
+}
+
+#ifdef _WIN32
+static void
+walk_dir(walkdir_t *wd, walkbatch_t *b) {
+	HANDLE h;
+	WIN32_FIND_DATAW fd;
+	TCHAR *pattern, *path;
+	if((pattern = walk_join(wd->path, L"*", 1)) == NULL) {
+		walk_error(wd->path, ENOMEM);
+		return;
+	}
+	h = FindFirstFileW(pattern, &fd);
+	free(pattern);
+	if(h == INVALID_HANDLE_VALUE) {
+		if(GetLastError() != ERROR_FILE_NOT_FOUND)
+			walk_error(wd->path, GetLastError() == ERROR_ACCESS_DENIED ? EACCES : ENOENT);
+		return;
+	}
+	do {
+		if(wcscmp(fd.cFileName, L".") == 0 || wcscmp(fd.cFileName, L"..") == 0)
+			continue;
+		/* junctions and symlinks are never followed, there is no inode to detect loops */
+		if(fd.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT)
+			continue;
+		if((path = walk_join(wd->path, fd.cFileName, wcslen(fd.cFileName))) == NULL) {
+			walk_error(wd->path, ENOMEM);
+			continue;
+		}
+		if(fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+			walk_push(path, wd->dev);
+		} else {
+			walk_file(b, path);
+		}
+	} while(FindNextFileW(h, &fd));
+	FindClose(h);
+}
+#else
+static void	/* classify one entry of a directory opened as dirfd */
+walk_entry(walkdir_t *wd, walkbatch_t *b, int dirfd, const char *name, int type) {
+	struct stat st;
+	char *path;
+	int stated = 0;
+	if(name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+		return;
+	/* d_type saves a stat for most entries */
+	if(type == DT_UNKNOWN
+	|| (type == DT_LNK && wopt.follow)
+	|| (type == DT_DIR && (wopt.follow || wopt.xdev))) {
+		if(fstatat(dirfd, name, &st, wopt.follow ? 0 : AT_SYMLINK_NOFOLLOW) < 0) {
+			if((path = walk_join(wd->path, name, strlen(name))) != NULL) {
+				walk_error(path, errno);
+				free(path);
+			}
+			return;
+		}
+		stated = 1;
+		type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN;
+	}
+	if(type != DT_DIR && type != DT_REG)
+		return;	/* symlinks not followed, devices, fifos, sockets */
+	if(type == DT_DIR && stated) {
+		if(wopt.xdev && (unsigned long long) st.st_dev != wd->dev)
+			return;
+		if(wopt.follow) {
+			int seen;
+			pthread_mutex_lock(&mutex_walk);
+			seen = walk_visited(st.st_dev, st.st_ino);
+			pthread_mutex_unlock(&mutex_walk);
+			if(seen) return;
+		}
+	}
+	if((path = walk_join(wd->path, name, strlen(name))) == NULL) {
+		walk_error(wd->path, ENOMEM);
+		return;
+	}
+	if(type == DT_DIR) {
+		walk_push(path, wd->dev);
+	} else {
+		walk_file(b, path);
+	}
+}
+
+#ifdef SYS_getdents64
+struct linux_dirent64 {
+	unsigned long long d_ino;
+	long long d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[];
+};
+#endif
+
+static void
+walk_dir(walkdir_t *wd, walkbatch_t *b) {
+	int fd;
+	if((fd = open(wd->path, O_RDONLY|O_DIRECTORY|O_CLOEXEC)) < 0) {
+		walk_error(wd->path, errno);
+		return;
+	}
+#ifdef SYS_getdents64
+	{
+		/* large reads, no per-entry libc overhead */
+		char buf[32768];
+		long n, off;
+		struct linux_dirent64 *d;
+		while((n = syscall(SYS_getdents64, fd, buf, sizeof(buf))) > 0) {
+			for(off = 0; off < n; off += d->d_reclen) {
+				d = (struct linux_dirent64 *) (buf + off);
+				walk_entry(wd, b, fd, d->d_name, d->d_type);
+			}
+		}
+		if(n < 0)
+			walk_error(wd->path, errno);
+		close(fd);
+	}
+#else
+	{
+		DIR *dir;
+		struct dirent *d;
+		if((dir = fdopendir(fd)) == NULL) {
+			walk_error(wd->path, errno);
+			close(fd);
+			return;
+		}
+		while((d = readdir(dir)) != NULL)
+			walk_entry(wd, b, dirfd(dir), d->d_name, d->d_type);
+		closedir(dir);
+	}
+#endif
+}
+#endif
+
+static void *
+walker(void *__) {
+	walkdir_t *wd;
+	walkbatch_t *b;
+	if((b = (walkbatch_t *) malloc(sizeof(walkbatch_t))) == NULL) {
+		fprintf(stderr, PREFIX "walker: malloc failed\n");
+		abort();
+	}
+	b->n = 0;
+	pthread_mutex_lock(&mutex_walk);
+	while(1) {
+		while(pending == NULL && busy > 0)
+			pthread_cond_wait(&cond_walk, &mutex_walk);
+		if(pending == NULL)
+			break;	/* nothing left and nobody can add more */
+		wd = pending;
+		pending = wd->link;
+		busy++;
+		pthread_mutex_unlock(&mutex_walk);
+		walk_dir(wd, b);
+		walk_flush(b);
+		free(wd->path);
+		free(wd);
+		pthread_mutex_lock(&mutex_walk);
+		if(--busy == 0 && pending == NULL)
+			pthread_cond_broadcast(&cond_walk);
+	}
+	if(--running == 0 && wdone != NULL)
+		wdone(warg);
+	pthread_mutex_unlock(&mutex_walk);
+	free(b);
+	return NULL;
+}
+
+int	/* walk the root directories on detached threads, 0 or errno */
+walk_start(TCHAR **roots, int nroots, int nthreads, walkopt_t *opt, writer_t *errout,
+		walk_emit_t emit, walk_done_t done, void *arg) {
+	pthread_t tid;
+	TCHAR *path;
+	int i, err = 0;
+	wopt = *opt;
+	werr = errout;
+	wemit = emit;
+	wdone = done;
+	warg = arg;
+	for(i = nroots - 1; i >= 0; i--) {	/* the first root is listed first */
+		unsigned long long dev = 0;
+#ifndef _WIN32
+		struct stat st;
+		/* roots given by the user are followed like find -H */
+		if(stat(roots[i], &st) < 0) {
+			walk_error(roots[i], errno);
+			continue;
+		}
+		dev = st.st_dev;
+		if(wopt.follow)
+			walk_visited(st.st_dev, st.st_ino);
+		path = strdup(roots[i]);
+#else
+		path = _wcsdup(roots[i]);
+#endif
+		if(path == NULL) {
+			walk_error(roots[i], ENOMEM);
+			continue;
+		}
+		walk_push(path, dev);
+	}
+	if(nthreads < 1) nthreads = 1;
+	if(nthreads > WALK_MAX_THREADS) nthreads = WALK_MAX_THREADS;
+	pthread_mutex_lock(&mutex_walk);
+	for(i = 0; i < nthreads; i++) {
+		if((err = pthread_create(&tid, NULL, walker, NULL)) != 0)
+			break;
+		running++;
+		pthread_detach(tid);
+	}
+	pthread_mutex_unlock(&mutex_walk);
+	return running > 0 ? 0 : err;
+}
+
+int	/* # of directories or entries that could not be read */
+walk_errors() {
+	return errors;
+}
@@ -0,0 +1,26 @@
+#ifndef __WALK_H__
+#define __WALK_H__
+
+/* parallel directory walker, streams regular files to a callback */
+
+#include "hashsumr.h"
+#include "writer.h"
+
+#define	WALK_BATCH	256	/* files handed to the callback at a time */
+#define	WALK_MAX_THREADS	8
+
+typedef struct walkopt_s {
+	int follow;	/* follow symbolic links below the roots */
+	int xdev;	/* stay on the file system of each root */
+}	walkopt_t;
+
+/* called concurrently by walker threads, the callback owns the paths */
+typedef void (*walk_emit_t)(TCHAR **paths, int n, void *arg);
+/* called once, by the last walker thread */
+typedef void (*walk_done_t)(void *arg);
+
+int  walk_start(TCHAR **roots, int nroots, int nthreads, walkopt_t *opt, writer_t *werr,
+		walk_emit_t emit, walk_done_t done, void *arg);
+int  walk_errors();
+
+#endif	/* __WALK_H__ */
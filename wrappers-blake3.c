@@ -1,4 +1,6 @@
 #include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
 #include "wrappers-blake3.h"
 
 ctx_t *
@@ -38,3 +40,152 @@ blake3_final(ctx_t *ctx, unsigned char *digest, unsigned int *dlen) {
 	return 1;
 }
 
+int
+blake3_reset(ctx_t *ctx) {
+	blake3_hasher_reset(ctx->b3hasher);
+	return 1;
+}
+
+
+/* subtree hashing for multithreaded blake3 (see hash_split), an aligned
+ * subtree is hashed by a regular hasher whose chunk counter starts at the
+ * subtree offset. only the chaining values of subtrees and their parents
+ * need the compression function below. */
+
+enum {
+	B3_CHUNK_START = 1,
+	B3_CHUNK_END   = 2,
+	B3_PARENT      = 4,
+	B3_ROOT        = 8,
+};
+
+static const uint32_t b3_iv[8] = {
+	0x6A09E667UL, 0xBB67AE85UL, 0x3C6EF372UL, 0xA54FF53AUL,
+	0x510E527FUL, 0x9B05688CUL, 0x1F83D9ABUL, 0x5BE0CD19UL
+};
+
+static const uint8_t b3_schedule[7][16] = {
+	{ 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 },
+	{ 2, 6, 3, 10, 7, 0, 4, 13, 1, 11, 12, 5, 9, 14, 15, 8 },
+	{ 3, 4, 10, 12, 13, 2, 7, 14, 6, 5, 9, 0, 11, 15, 8, 1 },
+	{ 10, 7, 12, 9, 14, 3, 13, 15, 4, 0, 11, 2, 5, 8, 1, 6 },
+	{ 12, 13, 9, 11, 15, 10, 14, 8, 7, 2, 5, 3, 0, 1, 6, 4 },
+	{ 9, 14, 11, 5, 8, 12, 15, 1, 13, 3, 0, 10, 2, 6, 4, 7 },
+	{ 11, 15, 5, 0, 1, 9, 8, 6, 14, 10, 2, 12, 3, 4, 7, 13 },
+};
+
+static uint32_t
+b3_load32(const uint8_t *p) {
+	return ((uint32_t) p[0]) | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static void
+b3_store32(uint8_t *p, uint32_t w) {
+	p[0] = (uint8_t) w;
+	p[1] = (uint8_t) (w >> 8);
+	p[2] = (uint8_t) (w >> 16);
+	p[3] = (uint8_t) (w >> 24);
+}
+
+#define	B3_ROTR(w, c)	(((w) >> (c)) | ((w) << (32 - (c))))
+#define	B3_G(s, a, b, c, d, x, y)	do { \
+	s[a] = s[a] + s[b] + (x); s[d] = B3_ROTR(s[d] ^ s[a], 16); \
+	s[c] = s[c] + s[d];       s[b] = B3_ROTR(s[b] ^ s[c], 12); \
+	s[a] = s[a] + s[b] + (y); s[d] = B3_ROTR(s[d] ^ s[a], 8);  \
+	s[c] = s[c] + s[d];       s[b] = B3_ROTR(s[b] ^ s[c], 7);  \
+} while(0)
+
+static void	/* the 32-byte chaining value output of a compression */
+b3_compress(const uint32_t cv[8], const uint8_t block[64], uint8_t block_len,
+		uint64_t counter, uint8_t flags, uint8_t out[32]) {
+	uint32_t s[16], m[16];
+	int i, r;
+	for(i = 0; i < 16; i++) m[i] = b3_load32(block + 4*i);
+	for(i = 0; i < 8; i++) s[i] = cv[i];
+	s[8]  = b3_iv[0];
+	s[9]  = b3_iv[1];
+	s[10] = b3_iv[2];
+	s[11] = b3_iv[3];
+	s[12] = (uint32_t) counter;
+	s[13] = (uint32_t) (counter >> 32);
+	s[14] = block_len;
+	s[15] = flags;
+	for(r = 0; r < 7; r++) {
+		const uint8_t *x = b3_schedule[r];
+		B3_G(s, 0, 4,  8, 12, m[x[0]],  m[x[1]]);
+		B3_G(s, 1, 5,  9, 13, m[x[2]],  m[x[3]]);
+		B3_G(s, 2, 6, 10, 14, m[x[4]],  m[x[5]]);
+		B3_G(s, 3, 7, 11, 15, m[x[6]],  m[x[7]]);
+		B3_G(s, 0, 5, 10, 15, m[x[8]],  m[x[9]]);
+		B3_G(s, 1, 6, 11, 12, m[x[10]], m[x[11]]);
+		B3_G(s, 2, 7,  8, 13, m[x[12]], m[x[13]]);
+		B3_G(s, 3, 4,  9, 14, m[x[14]], m[x[15]]);
+	}
+	for(i = 0; i < 8; i++) b3_store32(out + 4*i, s[i] ^ s[i+8]);
+}
+
+static void	/* out = cv of the parent of left and right (out may alias left) */
+b3_parent(const uint8_t *left, const uint8_t *right, uint8_t flags, uint8_t *out) {
+	uint8_t block[64];
+	memcpy(block, left, 32);
+	memcpy(block + 32, right, 32);
+	b3_compress(b3_iv, block, 64, 0, flags | B3_PARENT, out);
+}
+
+static int
+b3_popcount(uint64_t x) {
+	int n = 0;
+	for(; x != 0; x &= x - 1) n++;
+	return n;
+}
+
+void	/* offset must be a multiple of the subtree size (a power of 2 of chunks) */
+blake3_subtree_init(blake3_hasher *hasher, unsigned long long offset) {
+	uint64_t counter = offset / BLAKE3_CHUNK_LEN;
+	blake3_hasher_init(hasher);
+	hasher->chunk.chunk_counter = counter;
+	/* the hasher merges its cv stack by the total # of chunks, so reserve
+	 * (but never touch) the entries of the subtrees on our left */
+	hasher->cv_stack_len = (uint8_t) b3_popcount(counter);
+}
+
+void	/* non-root chaining value of a subtree fed to a blake3_subtree_init() hasher */
+blake3_subtree_cv(const blake3_hasher *hasher, unsigned long long offset, unsigned char cv[32]) {
+	const blake3_chunk_state *c = &hasher->chunk;
+	int n = b3_popcount(offset / BLAKE3_CHUNK_LEN), i = hasher->cv_stack_len;
+	if(c->buf_len == 0 && c->blocks_compressed == 0 && i >= n + 2) {
+		/* whole subtrees went through the fast path of blake3_hasher_update()
+		 * and left no chunk behind, the last two cvs make the bottom parent,
+		 * as in blake3_hasher_finalize() */
+		i -= 2;
+		b3_parent(&hasher->cv_stack[i * BLAKE3_OUT_LEN], &hasher->cv_stack[(i + 1) * BLAKE3_OUT_LEN], c->flags, cv);
+	} else {
+		b3_compress(c->cv, c->buf, c->buf_len, c->chunk_counter,
+			c->flags | (c->blocks_compressed == 0 ? B3_CHUNK_START : 0) | B3_CHUNK_END, cv);
+	}
+	while(i > n) {
+		i--;
+		b3_parent(&hasher->cv_stack[i * BLAKE3_OUT_LEN], cv, c->flags, cv);
+	}
+}
+
+void	/* root digest from n >= 2 subtree cvs, all but the last are of the same size */
+blake3_subtree_merge(const unsigned char *cvs, size_t n, unsigned char digest[BLAKE3_OUT_LEN]) {
+	uint8_t stack[64][32], out[32];
+	size_t i;
+	int len = 0;
+	for(i = 0; i < n; i++) {
+		/* merge completed subtrees, like blake3_hasher_update() does with chunks */
+		while(len > b3_popcount(i)) {
+			b3_parent(stack[len-2], stack[len-1], 0, stack[len-2]);
+			len--;
+		}
+		if(i < n - 1) memcpy(stack[len++], &cvs[i * 32], 32);
+	}
+	memcpy(out, &cvs[(n - 1) * 32], 32);
+	while(len > 1) {
+		len--;
+		b3_parent(stack[len], out, 0, out);
+	}
+	b3_parent(stack[0], out, B3_ROOT, digest);
+}
@@ -9,5 +9,11 @@ int    blake3_init(ctx_t *ctx, void *arg);
 void   blake3_free(ctx_t *ctx);
 int    blake3_update(ctx_t *ctx, void *buf, size_t bufsz);
 int    blake3_final(ctx_t *ctx, unsigned char *digest, unsigned int *dlen);
+int    blake3_reset(ctx_t *ctx);
+
+/* subtree hashing for multithreaded blake3 */
+void   blake3_subtree_init(blake3_hasher *hasher, unsigned long long offset);
+void   blake3_subtree_cv(const blake3_hasher *hasher, unsigned long long offset, unsigned char cv[32]);
+void   blake3_subtree_merge(const unsigned char *cvs, size_t n, unsigned char digest[BLAKE3_OUT_LEN]);
 
 #endif	/* __WRAPPER_BLAKE3_H__ */
@@ -15,13 +15,33 @@ openssl_new() {
 	return ctx;
 }
 
-typedef EVP_MD * (*evp_md_t )(void);
+static pthread_mutex_t mutex_fetch = PTHREAD_MUTEX_INITIALIZER;
+
+static const EVP_MD *	/* an explicit fetch saves the implicit one of each init */
+openssl_fetch(evpmd_t *m) {
+	const EVP_MD *md;
+	pthread_mutex_lock(&mutex_fetch);
+	if((md = m->md) == NULL) {
+		EVP_MD *fetched = NULL;
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+		fetched = EVP_MD_fetch(NULL, m->name, NULL);
+#endif
+		if(fetched == NULL) fetched = (EVP_MD *) m->legacy();
+		ATOMIC_STORE(&m->md, fetched);
+		md = fetched;
+	}
+	pthread_mutex_unlock(&mutex_fetch);
+	return md;
+}
 
 int
 openssl_init(ctx_t *ctx, void *arg) {
-	evp_md_t fevp = (evp_md_t) arg;
-	if(arg == NULL) return 0;
-	return EVP_DigestInit_ex(ctx->evp, fevp(), NULL);
+	evpmd_t *m = (evpmd_t *) arg;
+	const EVP_MD *md;
+	if(m == NULL) return 0;
+	if((md = ATOMIC_LOAD(&m->md)) == NULL)
+		md = openssl_fetch(m);
+	return EVP_DigestInit_ex(ctx->evp, md, NULL);
 }
 
 void
@@ -41,6 +61,11 @@ openssl_final(ctx_t *ctx, unsigned char *digest, unsigned int *dlen) {
 	return EVP_DigestFinal_ex(ctx->evp, digest, dlen);
 }
 
+int
+openssl_reset(ctx_t *ctx) {
+	return EVP_MD_CTX_reset(ctx->evp);
+}
+
 int
 openssl_final_xof(ctx_t *ctx, unsigned int outlen, unsigned char *digest, unsigned int *dlen) {
 	if(EVP_DigestFinalXOF(ctx->evp, digest, outlen) == 1) {
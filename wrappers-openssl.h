@@ -3,12 +3,24 @@
 
 #include "hashsumr.h"
 
+/* the argument of openssl_init(), the digest is fetched by name on first
+ * use and kept for the life of the process. the legacy getter is used
+ * if the fetch fails */
+typedef struct evpmd_s {
+	const char *name;
+	const EVP_MD *(*legacy)(void);
+	EVP_MD *md;
+}	evpmd_t;
+
+#define	EVPMD(name, legacy)	(&(evpmd_t) { name, legacy, NULL })
+
 /* openssl wrappers */
 ctx_t* openssl_new();
 int    openssl_init(ctx_t *ctx, void *arg);
 void   openssl_free(ctx_t *ctx);
 int    openssl_update(ctx_t *ctx, void *buf, size_t bufsz);
 int    openssl_final(ctx_t *ctx, unsigned char *digest, unsigned int *dlen);
+int    openssl_reset(ctx_t *ctx);
 int    openssl_final_xof(ctx_t *ctx, unsigned int outlen, unsigned char *digest, unsigned int *dlen);
 int    openssl_final_xof32(ctx_t *ctx, unsigned char *digest, unsigned int *dlen);
 int    openssl_final_xof64(ctx_t *ctx, unsigned char *digest, unsigned int *dlen);
@@ -2,6 +2,7 @@
 #ifdef _WIN32
 
 #include <stdlib.h>
+#include <string.h>
 #include <windows.h>
 #include <bcrypt.h>
 #include "wrappers-win32.h"
@@ -10,29 +11,41 @@ ctx_t *
 bcrypt_new() {
 	ctx_t *ctx = (ctx_t *) malloc(sizeof(ctx_t));
 	if(ctx == NULL) return NULL;
-	memset(ctx, 0, sizeof(ctx));
+	memset(ctx, 0, sizeof(ctx_t));
 	return ctx;
 }
 
-int
+int	/* the provider is opened once per context, a hash object per message */
 bcrypt_init(ctx_t *ctx, void *arg) {
 	NTSTATUS status;
 	DWORD cbResult;
-	status = BCryptOpenAlgorithmProvider(&ctx->bcryptHandle.hAlg, arg, NULL, 0);
-	if (!BCRYPT_SUCCESS(status)) return 0;
-	status = BCryptGetProperty(ctx->bcryptHandle.hAlg,
-		BCRYPT_HASH_LENGTH,
-		(PUCHAR) &ctx->bcryptHandle.len, sizeof(DWORD), &cbResult, 0);
-	if (!BCRYPT_SUCCESS(status) || cbResult != sizeof(DWORD)) return 0;
+	if(ctx->bcryptHandle.hAlg == NULL) {
+		status = BCryptOpenAlgorithmProvider(&ctx->bcryptHandle.hAlg, arg, NULL, 0);
+		if (!BCRYPT_SUCCESS(status)) {
+			ctx->bcryptHandle.hAlg = NULL;
+			return 0;
+		}
+		status = BCryptGetProperty(ctx->bcryptHandle.hAlg,
+			BCRYPT_HASH_LENGTH,
+			(PUCHAR) &ctx->bcryptHandle.len, sizeof(DWORD), &cbResult, 0);
+		if (!BCRYPT_SUCCESS(status) || cbResult != sizeof(DWORD)) return 0;
+	}
+	bcrypt_reset(ctx);
 	status = BCryptCreateHash(ctx->bcryptHandle.hAlg,
 		&ctx->bcryptHandle.hHash, NULL, 0, NULL, 0, 0);
-	if (!BCRYPT_SUCCESS(status)) return 0;
+	if (!BCRYPT_SUCCESS(status)) {
+		ctx->bcryptHandle.hHash = NULL;
+		return 0;
+	}
 	return 1;
 }
 
 void
 bcrypt_free(ctx_t *ctx) {
 	if(ctx == NULL) return;
+	bcrypt_reset(ctx);
+	if(ctx->bcryptHandle.hAlg != NULL)
+		BCryptCloseAlgorithmProvider(ctx->bcryptHandle.hAlg, 0);
 	free(ctx);
 }
 
@@ -47,13 +60,19 @@ bcrypt_update(ctx_t *ctx, void *buf, size_t bufsz) {
 int
 bcrypt_final(ctx_t *ctx, unsigned char *digest, unsigned int *dlen) {
 	NTSTATUS status; 
-	int ret = 1;
 	*dlen = ctx->bcryptHandle.len;
 	status = BCryptFinishHash(ctx->bcryptHandle.hHash, digest, *dlen, 0);
-	if (!BCRYPT_SUCCESS(status)) ret = 0;
-	BCryptDestroyHash(&ctx->bcryptHandle.hHash);
-	BCryptCloseAlgorithmProvider(&ctx->bcryptHandle.hAlg, 0);
-	return ret;
+	if (!BCRYPT_SUCCESS(status)) return 0;
+	return 1;
+}
+
+int	/* drop the hash object, keep the provider */
+bcrypt_reset(ctx_t *ctx) {
+	if(ctx->bcryptHandle.hHash != NULL) {
+		BCryptDestroyHash(ctx->bcryptHandle.hHash);
+		ctx->bcryptHandle.hHash = NULL;
+	}
+	return 1;
 }
 
 #endif
@@ -10,6 +10,7 @@ int    bcrypt_init(ctx_t *ctx, void *arg);
 void   bcrypt_free(ctx_t *ctx);
 int    bcrypt_update(ctx_t *ctx, void *buf, size_t bufsz);
 int    bcrypt_final(ctx_t *ctx, unsigned char *digest, unsigned int *dlen);
+int    bcrypt_reset(ctx_t *ctx);
 #endif	/* _WIN32 */
 
 #endif	/* __WRAPPER_OPENSSL_H__ */
@@ -0,0 +1,134 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+#include "hashsumr.h"
+#include "writer.h"
+
+static void *
+writer_main(void *arg) {
+	writer_t *w = (writer_t *) arg;
+	char *p;
+	size_t n;
+	pthread_mutex_lock(&w->mutex);
+	while(1) {
+		while(w->len == 0 && w->closing == 0)
+			pthread_cond_wait(&w->more, &w->mutex);
+		if(w->len == 0)
+			break;
+		if(w->len < WRITER_BUFSIZE / 2 && w->closing == 0) {
+			/* woken by the first line, let others join it */
+			pthread_mutex_unlock(&w->mutex);
+#ifdef _WIN32
+			Sleep(WRITER_DELAY);
+#else
+			usleep(WRITER_DELAY * 1000);
+#endif
+			pthread_mutex_lock(&w->mutex);
+		}
+		/* swap, lines go on to the other buffer while this one is written */
+		p = w->buf;
+		w->buf = w->out;
+		w->out = p;
+		n = w->len;
+		w->len = 0;
+		w->writing = 1;
+		pthread_cond_broadcast(&w->room);
+		pthread_mutex_unlock(&w->mutex);
+		fwrite(p, 1, n, w->fp);
+		fflush(w->fp);
+		pthread_mutex_lock(&w->mutex);
+		w->writing = 0;
+		pthread_cond_broadcast(&w->room);
+	}
+	pthread_mutex_unlock(&w->mutex);
+	return NULL;
+}
+
+int	/* 0 or errno. lines are written directly if the writer is not running */
+writer_start(writer_t *w, FILE *fp) {
+	int err;
+	memset(w, 0, sizeof(writer_t));
+	w->fp = fp;
+	pthread_mutex_init(&w->mutex, NULL);
+	pthread_cond_init(&w->more, NULL);
+	pthread_cond_init(&w->room, NULL);
+	if((w->buf = (char *) malloc(WRITER_BUFSIZE)) == NULL
+	|| (w->out = (char *) malloc(WRITER_BUFSIZE)) == NULL) {
+		free(w->buf);
+		w->buf = NULL;
+		return ENOMEM;
+	}
+	/* the buffers replace stdio buffering, a flush is one write(2) */
+	fflush(fp);
+	setvbuf(fp, NULL, _IONBF, 0);
+	if((err = pthread_create(&w->tid, NULL, writer_main, w)) != 0) {
+		free(w->buf);
+		free(w->out);
+		w->buf = w->out = NULL;
+		return err;
+	}
+	w->running = 1;
+	return 0;
+}
+
+void	/* append a complete line, thread-safe */
+writer_put(writer_t *w, const char *line, size_t len) {
+	if(w->running == 0 || len > WRITER_BUFSIZE) {
+		pthread_mutex_lock(&w->mutex);
+		while(w->running && (w->len > 0 || w->writing))	/* keep the order of lines */
+			pthread_cond_wait(&w->room, &w->mutex);
+		fwrite(line, 1, len, w->fp);
+		pthread_mutex_unlock(&w->mutex);
+		return;
+	}
+	pthread_mutex_lock(&w->mutex);
+	while(WRITER_BUFSIZE - w->len < len)
+		pthread_cond_wait(&w->room, &w->mutex);
+	if(w->len == 0)
+		pthread_cond_signal(&w->more);
+	memcpy(w->buf + w->len, line, len);
+	w->len += len;
+	pthread_mutex_unlock(&w->mutex);
+}
+
+int	/* format a line without holding any lock, then append it */
+writer_printf(writer_t *w, const char *fmt, ...) {
+	char line[WRITER_LINE], *p = line;
+	va_list ap;
+	int n;
+	va_start(ap, fmt);
+	n = vsnprintf(line, sizeof(line), fmt, ap);
+	va_end(ap);
+	if(n < 0)
+		return n;
+	if((size_t) n >= sizeof(line)) {
+		if((p = (char *) malloc(n + 1)) == NULL)
+			return -1;
+		va_start(ap, fmt);
+		vsnprintf(p, n + 1, fmt, ap);
+		va_end(ap);
+	}
+	writer_put(w, p, n);
+	if(p != line)
+		free(p);
+	return n;
+}
+
+void	/* write what is left and stop the writer thread, later lines are written directly */
+writer_stop(writer_t *w) {
+	if(w->running) {
+		pthread_mutex_lock(&w->mutex);
+		w->closing = 1;
+		pthread_cond_signal(&w->more);
+		pthread_mutex_unlock(&w->mutex);
+		pthread_join(w->tid, NULL);
+		w->running = 0;
+	}
+	free(w->buf);
+	free(w->out);
+	w->buf = w->out = NULL;
+}
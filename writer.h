@@ -0,0 +1,35 @@
+#ifndef __WRITER_H__
+#define __WRITER_H__
+
+/* output writer: threads format lines on their own and append them to
+ * a shared buffer, a writer thread swaps it for a second one and writes
+ * everything gathered so far with one call. a line is appended whole,
+ * so lines never interleave. lines wait at most WRITER_DELAY ms */
+
+#include <stdio.h>
+#include "hashsumr.h"
+
+#define	WRITER_BUFSIZE	(256<<10)	/* per buffer, two of them */
+#define	WRITER_LINE	(16<<10)	/* formatted on the stack, longer lines are allocated */
+#define	WRITER_DELAY	5	/* ms to gather more lines after the first one */
+
+typedef struct writer_s {
+	FILE *fp;
+	char *buf;	/* being filled */
+	char *out;	/* being written */
+	size_t len;
+	int running;	/* writer thread started */
+	int writing;	/* out is being written */
+	int closing;
+	pthread_t tid;
+	pthread_mutex_t mutex;
+	pthread_cond_t more;	/* for the writer thread */
+	pthread_cond_t room;	/* for threads waiting for a buffer */
+}	writer_t;
+
+int  writer_start(writer_t *w, FILE *fp);
+void writer_put(writer_t *w, const char *line, size_t len);
+int  writer_printf(writer_t *w, const char *fmt, ...);
+void writer_stop(writer_t *w);
+
+#endif	/* __WRITER_H__ */